@@ -0,0 +1,366 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#include "arg.h"
+#include "vt.h"
+
+#define CHUNK 4096		/* bytes fed per term_write(), like a pty read */
+#define STREAM_MB 16		/* default size of each synthetic stream */
+
+struct stream {
+	char *name;
+	char *buf;
+	size_t len, size;
+};
+
+char *argv0;
+
+/*
+ * allocations made by the core, the tem-bench target links with
+ * -Wl,--wrap for these
+ */
+static size_t nalloc;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *
+__wrap_malloc(size_t n) {
+	nalloc++;
+	return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size) {
+	nalloc++;
+	return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t n) {
+	nalloc++;
+	return __real_realloc(p, n);
+}
+
+/* the frontend would copy pixels here, there are none */
+void
+shift_flush() {
+	term.shift.n = 0;
+}
+
+static uint32_t seed = 2463534242;
+
+static uint32_t
+rnd() {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+void
+put(struct stream *s, const char *fmt, ...) {
+	va_list ap;
+	int n;
+
+	if (s->size - s->len < 256) {
+		s->size = s->size ? s->size * 2 : 1 << 16;
+		s->buf = realloc(s->buf, s->size);
+		if (s->buf == NULL)
+			err(1, "realloc");
+	}
+
+	va_start(ap, fmt);
+	n = vsnprintf(s->buf + s->len, s->size - s->len, fmt, ap);
+	va_end(ap);
+
+	s->len += n;
+}
+
+/* a random word of printable ascii */
+char *
+word() {
+	static char w[16];
+	int i, n;
+
+	n = 1 + rnd() % 10;
+	for (i = 0; i < n; i++)
+		w[i] = 'a' + rnd() % 26;
+	w[i] = '\0';
+
+	return w;
+}
+
+/* full lines of plain text, like cat of a source file */
+void
+gen_ascii(struct stream *s, size_t size) {
+	int col;
+
+	for (col = 0; s->len < size;) {
+		put(s, "%s ", word());
+		if ((col += 8) >= 72) {
+			put(s, "\r\n");
+			col = 0;
+		}
+	}
+}
+
+/* colored words, like ls --color or a compiler log */
+void
+gen_sgr(struct stream *s, size_t size) {
+	int col;
+
+	for (col = 0; s->len < size;) {
+		switch (rnd() % 4) {
+		case 0:
+			put(s, "\033[%d;%dm", rnd() % 2, 30 + rnd() % 8);
+			break;
+		case 1:
+			put(s, "\033[38;5;%dm", rnd() % 256);
+			break;
+		case 2:
+			put(s, "\033[%d;%dm", 30 + rnd() % 8, 40 + rnd() % 8);
+			break;
+		case 3:
+			put(s, "\033[m");
+			break;
+		}
+
+		put(s, "%s ", word());
+		if ((col += 8) >= 72) {
+			put(s, "\033[0m\r\n");
+			col = 0;
+		}
+	}
+}
+
+/* short lines, nearly every byte scrolls, like tail -f */
+void
+gen_scroll(struct stream *s, size_t size) {
+	unsigned n;
+
+	for (n = 0; s->len < size; n++)
+		put(s, "%u %s\r\n", n, word());
+}
+
+/* full screen redraws by cursor address, like top or an editor */
+void
+gen_tui(struct stream *s, size_t size) {
+	int y, x;
+
+	put(s, "\033[?1049h\033[?25l");
+	while (s->len < size) {
+		put(s, "\033[H\033[7m%-79s\033[m", " PID USER  CPU  MEM COMMAND");
+		for (y = 2; y < 23; y++) {
+			put(s, "\033[%d;1H%5u %-5s %4.1f %4.1f %s\033[K", y,
+					rnd() % 65536, word(), (rnd() % 1000) / 10.0,
+					(rnd() % 1000) / 10.0, word());
+
+			x = 1 + rnd() % 70;
+			put(s, "\033[%d;%dH\033[1;3%dm%s\033[m", y, x, rnd() % 8, word());
+		}
+		put(s, "\033[23;1H\033[J%s", word());
+	}
+	put(s, "\033[?25h\033[?1049l");
+}
+
+/* two and three byte sequences mixed with ascii */
+void
+gen_utf8(struct stream *s, size_t size) {
+	static const char *text[] = {
+		"größe", "naïve", "ελληνικά", "кириллица", "日本語",
+		"漢字", "한국어", "─┼─│", "€", "→⇒", "ascii"
+	};
+	int col;
+
+	for (col = 0; s->len < size;) {
+		put(s, "%s ", text[rnd() % LEN(text)]);
+		if ((col += 8) >= 72) {
+			put(s, "\r\n");
+			col = 0;
+		}
+	}
+}
+
+/*
+ * every cell its own random colors and glyph, as little as the history
+ * blocks it scrolls into can compress
+ */
+void
+gen_noise(struct stream *s, size_t size) {
+	char c[4];
+	int col, n;
+
+	for (col = 1; s->len < size; col++) {
+		put(s, "\033[%d;38;2;%d;%d;%d;48;2;%d;%d;%d;58:2::%d:%d:%dm",
+				rnd() % 10, rnd() % 256, rnd() % 256, rnd() % 256,
+				rnd() % 256, rnd() % 256, rnd() % 256,
+				rnd() % 256, rnd() % 256, rnd() % 256);
+
+		/* nothing below U+0300 is wide or combining */
+		n = utf_encode(0x100 + rnd() % 0x200, c);
+		put(s, "%.*s%s", n, c, col % 80 ? "" : "\033[m\r\n");
+	}
+}
+
+/*
+ * random bytes, which lz_pack() has to give up on rather than write past
+ * max, and mostly repeating text, which has to come back unchanged
+ */
+void
+check_pack() {
+	static uint8_t in[1 << 16], back[1 << 16];
+	uint8_t *out;
+	size_t i, n;
+
+	if ((out = malloc(sizeof(in) - 1)) == NULL)
+		err(1, "malloc");
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = rnd();
+	if (lz_pack(in, sizeof(in), out, sizeof(in) - 1) != 0)
+		errx(1, "lz_pack: random bytes got smaller");
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = "tem bench "[i % 10] ^ (rnd() % 16 == 0);
+	if ((n = lz_pack(in, sizeof(in), out, sizeof(in) - 1)) == 0)
+		errx(1, "lz_pack: text did not get smaller");
+	lz_unpack(out, n, back);
+	if (memcmp(in, back, sizeof(in)))
+		errx(1, "lz_pack: text changed");
+
+	free(out);
+}
+
+/* a recorded stream, for instance from script(1) */
+void
+load(struct stream *s, const char *path) {
+	FILE *f;
+	size_t n;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+
+	do {
+		put(s, "");
+		n = fread(s->buf + s->len, 1, s->size - s->len - 1, f);
+		s->len += n;
+	} while (n > 0);
+
+	if (ferror(f))
+		err(1, "%s", path);
+	fclose(f);
+}
+
+/* a fresh 80x24 terminal, as tem starts with */
+void
+reset() {
+	term_free();
+	memset(&term, 0, sizeof(term));
+	term.cursor_vis = 1;
+	term.hist.max = HISTLINES;
+	term_resize(80, 24);
+}
+
+/* what redraw() does to the core each frame, minus the drawing */
+void
+frame() {
+	int y;
+
+	shift_flush();
+	for (y = 0; y < term.height; y++)
+		if (DIRTY_ISSET(y))
+			(void)view_row(y);
+
+	memset(term.dirty, 0, (term.height + 8) / 8);
+	term.wants_redraw = 0;
+}
+
+long long
+nsnow() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+run(struct stream *s) {
+	long long t;
+	size_t i, n, allocs;
+
+	reset();
+	allocs = nalloc;
+	t = nsnow();
+
+	for (i = 0; i < s->len; i += n) {
+		n = s->len - i < CHUNK ? s->len - i : CHUNK;
+		term_write(s->buf + i, n);
+		frame();
+	}
+
+	t = nsnow() - t;
+	allocs = nalloc - allocs;
+
+	printf("%-16s %8.1f MB/s %8.2f ns/byte %10zu allocs\n", s->name,
+			s->len / (t / 1e9) / (1 << 20), (double)t / s->len, allocs);
+}
+
+void
+usage() {
+	errx(1, "usage: %s [-s MB] [file ...]", argv0);
+}
+
+int
+main(int argc, char **argv) {
+	static void (*gen[])(struct stream *, size_t) = {
+		gen_ascii, gen_sgr, gen_scroll, gen_tui, gen_utf8, gen_noise
+	};
+	static char *names[] = {
+		"ascii", "sgr", "scroll", "tui", "utf8", "noise"
+	};
+	struct stream s;
+	size_t size;
+	int i;
+
+	size = STREAM_MB;
+
+	ARGBEGIN {
+	case 's':
+		size = strtoul(EARGF(usage()), NULL, 10);
+		break;
+	default:
+		usage();
+	} ARGEND
+
+	size <<= 20;
+
+	check_pack();
+
+	if (argc == 0) {
+		for (i = 0; i < (int)LEN(gen); i++) {
+			memset(&s, 0, sizeof(s));
+			s.name = names[i];
+			gen[i](&s, size);
+			run(&s);
+			free(s.buf);
+		}
+	}
+
+	for (i = 0; i < argc; i++) {
+		memset(&s, 0, sizeof(s));
+		s.name = argv[i];
+		load(&s, argv[i]);
+		run(&s);
+		free(s.buf);
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+# generate keysym.h from the X11 keysym definitions:
+#
+#	awk -f mkkeysym.awk keysymdef.h > keysym.h
+#
+# the legacy keysyms below 0x2100 (latin-2 to 4 and 9, kana, arabic,
+# cyrillic, greek, the technical and publishing sets, hebrew, thai,
+# korean and the currency signs) are not their codepoint.  keysymdef.h
+# names the codepoint of each in a comment, approximations in parentheses
+# are left out.  the result is sorted by keysym for a binary search.
+
+function hex(s,    i, n) {
+	s = toupper(s)
+	for (i = 1; i <= length(s); i++)
+		n = n * 16 + index("0123456789ABCDEF", substr(s, i, 1)) - 1
+	return n
+}
+
+$1 == "#define" && $4 == "/*" && $5 ~ /^U\+[0-9A-Fa-f]+$/ {
+	sym = hex(substr($3, 3))
+	# 0x100 to 0x2100, awk has no hex constants
+	if (sym < 256 || sym >= 8448 || sym in ucs)
+		next
+
+	ucs[sym] = hex(substr($5, 3))
+	syms[n++] = sym
+}
+
+END {
+	# insertion sort, keysymdef.h is almost in order already
+	for (i = 1; i < n; i++) {
+		s = syms[i]
+		for (j = i - 1; j >= 0 && syms[j] > s; j--)
+			syms[j + 1] = syms[j]
+		syms[j + 1] = s
+	}
+
+	print "/* generated by mkkeysym.awk from keysymdef.h, do not edit */"
+	print ""
+	print "static const struct {"
+	print "\tuint16_t sym, ucs;"
+	print "} keysym_ucs[] = {"
+	for (i = 0; i < n; i++)
+		printf("%s{ 0x%04x, 0x%04x },%s", i % 4 ? " " : "\t",
+				syms[i], ucs[syms[i]], i % 4 == 3 || i == n - 1 ? "\n" : "")
+	print "};"
+}
@@ -0,0 +1,95 @@
+# generate width.h from the unicode character database:
+#
+#	awk -f mkwidth.awk EastAsianWidth.txt UnicodeData.txt > width.h
+#
+# wide and fullwidth characters take two columns, combining marks, format
+# characters and hangul medial vowels and final consonants none, the rest
+# one.  the result is a two stage table: width_stage1 maps each block of
+# 256 codepoints to a row of width_stage2, which packs four 2 bit widths
+# per byte, and identical blocks share a row.
+
+function hex(s,    i, n) {
+	s = toupper(s)
+	for (i = 1; i <= length(s); i++)
+		n = n * 16 + index("0123456789ABCDEF", substr(s, i, 1)) - 1
+	return n
+}
+
+function range(s, w,    r, c) {
+	split(s, r, /\.\./)
+	if (r[2] == "")
+		r[2] = r[1]
+	for (c = hex(r[1]); c <= hex(r[2]); c++)
+		width[c] = w
+}
+
+BEGIN {
+	FS = ";"
+}
+
+FNR == 1 && FILENAME ~ /EastAsianWidth/ {
+	version = $0
+	sub(/^# */, "", version)
+}
+
+FILENAME ~ /EastAsianWidth/ && /^[0-9A-Fa-f]/ {
+	cp = $1
+	eaw = $2
+	gsub(/[ \t]/, "", cp)
+	sub(/#.*/, "", eaw)
+	gsub(/[ \t]/, "", eaw)
+	if (eaw == "W" || eaw == "F")
+		range(cp, 2)
+}
+
+FILENAME ~ /UnicodeData/ {
+	# ranges are given as a <..., First> and <..., Last> pair
+	if ($2 ~ /, First>$/) {
+		first = $1
+		next
+	}
+	cp = $2 ~ /, Last>$/ ? first ".." $1 : $1
+
+	if ($3 == "Mn" || $3 == "Me" || ($3 == "Cf" && $1 != "00AD"))
+		range(cp, 0)
+}
+
+END {
+	range("1160..11FF", 0)
+
+	nblocks = 0
+	for (b = 0; b < 4352; b++) {
+		row = ""
+		for (i = 0; i < 256; i += 4) {
+			byte = 0
+			for (j = 3; j >= 0; j--) {
+				c = b * 256 + i + j
+				byte = byte * 4 + (c in width ? width[c] : 1)
+			}
+			row = row sprintf("%s0x%02x,", i % 32 ? " " : (i ? "\n\t\t" : "\t\t"), byte)
+		}
+
+		if (!(row in index_of)) {
+			index_of[row] = nblocks
+			rows[nblocks++] = row
+		}
+		stage1[b] = index_of[row]
+	}
+
+	if (nblocks > 256) {
+		print "mkwidth.awk: more than 256 distinct blocks" > "/dev/stderr"
+		exit 1
+	}
+
+	print "/* generated by mkwidth.awk from " version ", do not edit */"
+	print ""
+	print "static const uint8_t width_stage1[0x110000 >> 8] = {"
+	for (b = 0; b < 4352; b++)
+		printf("%s%d,%s", b % 16 ? " " : "\t", stage1[b], b % 16 == 15 ? "\n" : "")
+	print "};"
+	print ""
+	print "static const uint8_t width_stage2[][64] = {"
+	for (i = 0; i < nblocks; i++)
+		print "\t{\n" rows[i] "\n\t},"
+	print "};"
+}
@@ -1,9 +1,21 @@
+#define _GNU_SOURCE	/* struct ucred */
+
 #include <xcb/xcb.h>
 #include <xcb/xcb_keysyms.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_xrm.h>
 #include <xcb/xcbext.h>
+#include <xcb/render.h>
+#include <xcb/xcb_renderutil.h>
+#include <xcb/shm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/keysym.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <string.h>
 #include <locale.h>
 #include <stdarg.h>
@@ -13,43 +25,70 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <err.h>
 
+#include <sys/wait.h>
+
 #if defined(__FreeBSD__) || defined(__OpenBSD__)
 	#include <libutil.h>
 #elif defined(__linux__)
 	#include <pty.h>
+	#include <sys/signalfd.h>
+	#include <sys/timerfd.h>
 #endif
 
 #include "arg.h"
+#include "vt.h"
+#include "tty.h"
 #include "tem.h"
+#include "keysym.h"
 
 static xcb_connection_t *conn;
 static xcb_screen_t *scr;
-static xcb_window_t win;
+static struct win_s *wins;
+static struct win_s *cur;	/* the window being worked on */
+static term_t conf;		/* what new windows start out with */
+static char fontline[BUFSIZ];
 static struct font_s *font;
-static term_t term;
-static xcb_gcontext_t gc;
-static int d;
+static xcb_atom_t atoms[NATOMS];
+static struct xfer xfers[SEL_XFERS];
+static int nxfer;
+static size_t sel_chunk;
+static struct client_s clients[SOCK_CLIENTS];
+
+extern char **environ;
+static xcb_timestamp_t evtime;	/* of the key press being handled */
+static xcb_key_symbols_t *keysyms;
+static struct keyseq keytab[256][8];
+static struct xrender_s xr;
+static struct shm_s shm;
+static struct bgfill bgfill[BG_FILLS];
+static int nbgfill;
 
 /*
  * thanks for wmdia for doing what xcb devs can't
  */
 xcb_void_cookie_t
 xcb_poly_text_16_simple(xcb_connection_t *c, xcb_drawable_t drawable,
-		xcb_gcontext_t gc, int16_t x, int16_t y, uint32_t len,
-		const uint16_t *str)
+		xcb_gcontext_t gc, int16_t x, int16_t y, uint32_t nitems,
+		const struct text_item16 *items)
 {
-	struct iovec xcb_parts[7];
-	static const xcb_protocol_request_t xcb_req = {
-		5,                /* count  */
+	struct iovec xcb_parts[5 + 2 * nitems];
+	xcb_protocol_request_t xcb_req = {
+		3 + 2 * nitems,   /* count  */
 		0,                /* ext    */
 		XCB_POLY_TEXT_16, /* opcode */
 		1                 /* isvoid */
 	};
-	uint8_t xcb_lendelta[2];
+	uint8_t xcb_lendelta[2 * nitems];
 	xcb_void_cookie_t xcb_ret;
 	xcb_poly_text_8_request_t xcb_out;
+	size_t len;
+	uint32_t i;
 
 	xcb_out.pad0 = 0;
 	xcb_out.drawable = drawable;
@@ -57,58 +96,94 @@ xcb_poly_text_16_simple(xcb_connection_t *c, xcb_drawable_t drawable,
 	xcb_out.x = x;
 	xcb_out.y = y;
 
-	xcb_lendelta[0] = len;
-	xcb_lendelta[1] = 0;
-
 	xcb_parts[2].iov_base = (char *)&xcb_out;
 	xcb_parts[2].iov_len = sizeof(xcb_out);
 	xcb_parts[3].iov_base = 0;
 	xcb_parts[3].iov_len = -xcb_parts[2].iov_len & 3;
 
-	xcb_parts[4].iov_base = xcb_lendelta;
-	xcb_parts[4].iov_len = sizeof(xcb_lendelta);
-	xcb_parts[5].iov_base = (char *)str;
-	xcb_parts[5].iov_len = len * sizeof(int16_t);
+	for (i = len = 0; i < nitems; i++) {
+		xcb_lendelta[2 * i] = items[i].len;
+		xcb_lendelta[2 * i + 1] = items[i].delta;
+
+		xcb_parts[4 + 2 * i].iov_base = xcb_lendelta + 2 * i;
+		xcb_parts[4 + 2 * i].iov_len = 2;
+		xcb_parts[5 + 2 * i].iov_base = (char *)items[i].str;
+		xcb_parts[5 + 2 * i].iov_len = items[i].len * sizeof(int16_t);
 
-	xcb_parts[6].iov_base = 0;
-	xcb_parts[6].iov_len = -(xcb_parts[4].iov_len + xcb_parts[5].iov_len)
-		& 3;
+		len += 2 + xcb_parts[5 + 2 * i].iov_len;
+	}
+
+	xcb_parts[4 + 2 * nitems].iov_base = 0;
+	xcb_parts[4 + 2 * nitems].iov_len = -len & 3;
 
 	xcb_ret.sequence = xcb_send_request(c, 0, xcb_parts + 2, &xcb_req);
 
 	return xcb_ret;
 }
 
+/* make w the window drawing goes to, and its terminal term */
 void
-clr_cell(int x, int y) {
-	xcb_clear_area(conn, 0, win,
-			(term.padding) + x * font->width,
-			(term.padding) + y * font->height,
-			(term.padding * 2) + term.width * font->width,
-			(term.padding * 2) + term.height * font->height
-	);
+win_select(struct win_s *w) {
+	cur = w;
+	termp = &w->vt;
+}
+
+struct win_s *
+win_find(xcb_window_t id) {
+	struct win_s *w;
+
+	for (w = wins; w != NULL; w = w->next)
+		if (w->win == id)
+			return w;
+
+	return NULL;
 }
 
+/*
+ * apply the pending shift to the back buffer with one CopyArea, the rows
+ * it exposes are already damaged
+ */
 void
-cursormv(int dir) {
-	switch (dir) {
-	case UP:
-		if (valid_xy(term.cursor.x, term.cursor.y - 1))
-			term.cursor.y--;
-		break;
-	case DOWN:
-		if (valid_xy(term.cursor.x, term.cursor.y + 1))
-			term.cursor.y++;
-		break;
-	case RIGHT:
-		if (valid_xy(term.cursor.x + 1, term.cursor.y))
-			term.cursor.x++;
-		break;
-	case LEFT:
-		if (valid_xy(term.cursor.x - 1, term.cursor.y))
-			term.cursor.x--;
-		break;
+shift_flush() {
+	struct xt_shift *sh = &term.shift;
+	int n, h, src, dst;
+
+	n = sh->n;
+	if (n == 0)
+		return;
+	sh->n = 0;
+
+	/* shm_put() may still be reading the image, repaint instead */
+	if (term.render == R_SHM && cur->img.busy) {
+		damage_all();
+		return;
+	}
+
+	h = sh->y1 - sh->y0 - abs(n);
+	if (h <= 0)
+		return;
+
+	src = sh->y0 + (n > 0 ? n : 0);
+	dst = sh->y0 + (n > 0 ? 0 : -n);
+
+	xcb_copy_area(conn, cur->backbuf, cur->backbuf, cur->gc,
+			0, CELL_Y(src), 0, CELL_Y(dst),
+			term.winsiz.x, h * font->height);
+
+	if (term.render == R_SHM) {
+		h *= font->height;
+		if (CELL_Y(src > dst ? src : dst) + h > cur->img.height)
+			h = cur->img.height - CELL_Y(src > dst ? src : dst);
+		if (h > 0)
+			memmove(cur->img.px + CELL_Y(dst) * cur->img.width,
+					cur->img.px + CELL_Y(src) * cur->img.width,
+					h * cur->img.width * sizeof(*cur->img.px));
 	}
+
+	if (term.shown0 > sh->y0)
+		term.shown0 = sh->y0;
+	if (term.shown1 < sh->y1)
+		term.shown1 = sh->y1;
 }
 
 void
@@ -118,7 +193,7 @@ set_fg(int fg) {
 
 	mask = XCB_GC_FOREGROUND;
 	values[0] = fg;
-	xcb_change_gc(conn, gc, mask, values);
+	xcb_change_gc(conn, cur->gc, mask, values);
 	term.fg = fg;
 
 	return;
@@ -131,98 +206,474 @@ set_bg(int bg) {
 
 	mask = XCB_CW_BACK_PIXEL;
 	values[0] = bg;
-	xcb_change_window_attributes(conn, win, mask, values);
+	xcb_change_window_attributes(conn, cur->win, mask, values);
+	xcb_change_gc(conn, cur->bgc, XCB_GC_FOREGROUND, values);
 }
 
+/*
+ * draw cells x0..x1 of row y, which all share one foreground, as a single
+ * PolyText16 request; empty cells become pen deltas between items
+ */
 void
-set_color_fg(uint8_t c) {
-	set_fg(colors[c - 1]);
+draw_run(struct tattr *row, int y, int x0, int x1) {
+	struct text_item16 items[TEXT_ITEMS];
+	uint16_t glyphs[x1 - x0];
+	int x, start, origin, gap, n;
+
+	origin = x0;
+	gap = n = 0;
+
+	for (x = x0; x < x1;) {
+		if (!row[x].ch) {
+			gap += font->width;
+			x++;
+			continue;
+		}
+
+		if (n + 2 + gap / 127 > TEXT_ITEMS) {
+			xcb_poly_text_16_simple(conn, cur->backbuf, cur->gc,
+					CELL_X(origin), BASELINE(y),
+					n, items);
+			origin = x;
+			gap = n = 0;
+		}
+
+		for (; gap > 127; gap -= 127) {
+			items[n].delta = 127;
+			items[n].len = 0;
+			items[n++].str = NULL;
+		}
+
+		for (start = x; x < x1 && row[x].ch && x - start < TEXT_ITEM_MAX; x++)
+			glyphs[x - x0] = SWAP16(GLYPH(row[x].ch));
+
+		items[n].delta = gap;
+		items[n].len = x - start;
+		items[n++].str = glyphs + start - x0;
+		gap = 0;
+	}
+
+	if (n)
+		xcb_poly_text_16_simple(conn, cur->backbuf, cur->gc,
+				CELL_X(origin), BASELINE(y),
+				n, items);
+}
+
+/* pixel value of a style color, def stands in for the default */
+uint32_t
+color_pixel(uint32_t c, uint32_t def) {
+	if (c == 0)
+		return def;
+	if (IS_RGB(c))
+		return c & 0xffffff;
+
+	return colors[c - 1];
+}
+
+/* the foreground color of s, bold brightens the first eight */
+uint32_t
+bold_fg(const struct style *s) {
+	if (s->attr & BOLD && s->fg >= COLOR_PAL(0) && s->fg <= COLOR_PAL(7))
+		return s->fg + 8;
+
+	return s->fg;
+}
+
+/* what cells of style s are filled with */
+uint32_t
+style_bg(const struct style *s) {
+	if (s->attr & REVERSE)
+		return color_pixel(bold_fg(s), term.default_fg);
+
+	return color_pixel(s->bg, term.default_bg);
+}
+
+/* what glyphs of style s are drawn in */
+uint32_t
+style_fg(const struct style *s) {
+	uint32_t pixel;
+
+	if (s->attr & INVISIBLE)
+		return style_bg(s);
+
+	if (s->attr & REVERSE)
+		pixel = color_pixel(s->bg, term.default_bg);
+	else
+		pixel = color_pixel(bold_fg(s), term.default_fg);
+
+	if (s->attr & DIM)
+		pixel = pixel >> 1 & 0x7f7f7f;
+
+	return pixel;
 }
 
+/* a one pixel line across cells x0..x1 of row y, dy below the cell top */
 void
-set_color_bg(int c) {
-	set_bg(colors[c]);
+draw_hline(int y, int dy, int x0, int x1, uint32_t fg) {
+	xcb_rectangle_t rect;
+
+	rect.x = CELL_X(x0);
+	rect.y = CELL_Y(y) + dy;
+	rect.width = (x1 - x0) * font->width;
+	rect.height = 1;
+
+	if (term.render == R_SHM) {
+		shm_fill(rect.x, rect.y, rect.width, rect.height, fg);
+		return;
+	}
+
+	if (fg != term.fg)
+		set_fg(fg);
+	xcb_poly_fill_rectangle(conn, cur->backbuf, cur->gc, 1, &rect);
 }
 
-int
-redraw(int ln) {
-	int x, y;
+/*
+ * underline, strike and overline of style s over cells x0..x1 of row y.
+ * the underline sits in the cell's descent, curly, dotted and dashed ones
+ * are drawn straight
+ */
+void
+draw_lines(int y, int x0, int x1, const struct style *s, uint32_t fg) {
+	int base;
+
+	if (s->attr & OVERLINE)
+		draw_hline(y, 0, x0, x1, fg);
+	if (s->attr & STRUCK)
+		draw_hline(y, (font->height - font->descent) * 2 / 3, x0, x1, fg);
+
+	if (!(s->attr & UNDERLINE))
+		return;
+
+	if (s->ul)
+		fg = color_pixel(s->ul, fg);
+	base = font->height - font->descent + (font->descent > 1);
+	draw_hline(y, base, x0, x1, fg);
+	if (UL_GET(s->attr) == UL_DOUBLE && base + 2 < font->height)
+		draw_hline(y, base + 2, x0, x1, fg);
+}
+
+/*
+ * the same for a run redraw() merged over empty cells, which carry no
+ * decoration of their own: only the stretches with glyphs get lines,
+ * and both halves of a wide one
+ */
+void
+draw_run_lines(struct tattr *row, int y, int x0, int x1,
+		const struct style *s, uint32_t fg) {
+	int x;
+
+	if (!(s->attr & (OVERLINE | STRUCK | UNDERLINE)))
+		return;
+
+	while (x0 < x1) {
+		for (; x0 < x1 && !row[x0].ch && !(row[x0].flags & WDUMMY); x0++)
+			;
+		for (x = x0; x < x1 && (row[x].ch || row[x].flags & WDUMMY); x++)
+			;
+		if (x > x0 && row[x - 1].flags & WIDE && x < term.width)
+			x++;
+
+		if (x0 < x)
+			draw_lines(y, x0, x, s, fg);
+		x0 = x;
+	}
+}
+
+/* fill the queued spans of f, the default background with bgc */
+void
+bg_fill(struct bgfill *f) {
+	if (f->n == 0)
+		return;
+
+	if (f->pixel == term.default_bg)
+		xcb_poly_fill_rectangle(conn, cur->backbuf, cur->bgc, f->n,
+				f->rect);
+	else {
+		if (f->pixel != term.fg)
+			set_fg(f->pixel);
+		xcb_poly_fill_rectangle(conn, cur->backbuf, cur->gc, f->n, f->rect);
+	}
+	f->n = 0;
+}
+
+void
+bg_flush() {
 	int i;
 
+	for (i = 0; i < nbgfill; i++)
+		bg_fill(&bgfill[i]);
+	nbgfill = 0;
+}
+
+/* queue a fill of cells x0..x1 of row y */
+void
+bg_span(int y, int x0, int x1, uint32_t pixel) {
+	struct bgfill *f;
+	xcb_rectangle_t *rect;
+
+	for (f = bgfill; f < bgfill + nbgfill && f->pixel != pixel; f++)
+		;
+
+	if (f == bgfill + BG_FILLS) {
+		bg_flush();
+		f = bgfill;
+	}
+	if (f == bgfill + nbgfill) {
+		f->pixel = pixel;
+		nbgfill++;
+	}
+	if (f->n == BG_RECTS)
+		bg_fill(f);
+
+	rect = &f->rect[f->n++];
+	rect->x = CELL_X(x0);
+	rect->y = CELL_Y(y);
+	rect->width = (x1 - x0) * font->width;
+	rect->height = font->height;
+}
+
+/* queue the backgrounds of cells x0..x1 of row y, a span per color */
+void
+bg_row(struct tattr *row, int y, int x0, int x1) {
+	uint32_t pixel, bg;
+	uint16_t id;
+	int x, start;
+
+	id = row[x0].style;
+	pixel = style_bg(&term.styles[id]);
+	for (start = x = x0; x < x1; x++) {
+		if (row[x].style == id)
+			continue;
+
+		id = row[x].style;
+		if ((bg = style_bg(&term.styles[id])) == pixel)
+			continue;
+
+		bg_span(y, start, x, pixel);
+		start = x;
+		pixel = bg;
+	}
+
+	bg_span(y, start, x1, pixel);
+}
+
+int
+redraw() {
+	struct tattr *row;
+	uint32_t fg;
+	uint16_t id;
+	int x, y, start, end, lines;
+
+	/* the cursor is painted over the map, so its old and new cells are stale */
+	damage_view(term.redraw_pos.x, term.redraw_pos.x + 1, term.redraw_pos.y);
+	damage(term.cursor.x, term.cursor.x + 1, term.cursor.y);
+
+	/* the server still reads the image, the frame waits for it */
+	if (term.render == R_SHM && cur->img.busy)
+		return 0;
+
 	term.wants_redraw = 0;
-	clrscr(ln ? ln : 0);
 
-	for (x = 0; x < term.width; x++) {
-		for (y = 0; y < term.height; y++) {
-			if (ln && y != ln)
+	shift_flush();
+
+	/* backgrounds before any glyph, a request per color in the frame */
+	if (term.render != R_SHM) {
+		for (y = 0; y < term.height; y++)
+			if (DIRTY_ISSET(y) && term.damage[y].x0 < term.damage[y].x1)
+				bg_row(view_row(y), y, term.damage[y].x0,
+						term.damage[y].x1);
+		bg_flush();
+	}
+
+	for (y = 0; y < term.height; y++) {
+		if (!DIRTY_ISSET(y))
+			continue;
+
+		row = view_row(y);
+		if (term.render == R_SHM) {
+			shm_draw_row(row, y, term.damage[y].x0, term.damage[y].x1);
+			continue;
+		}
+
+		for (x = term.damage[y].x0; x < term.damage[y].x1;) {
+			if (!row[x].ch) {
+				x++;
 				continue;
+			}
 
-			i = x + (y * term.width);
+			/*
+			 * extend the run over empty cells and cells drawn alike,
+			 * a style is only looked at when the index changes
+			 */
+			id = row[x].style;
+			fg = style_fg(&term.styles[id]);
+			lines = id;
+			for (start = x, end = x + 1; x < term.damage[y].x1; x++) {
+				if (!row[x].ch)
+					continue;
+
+				if (row[x].style != id) {
+					id = row[x].style;
+					if (style_fg(&term.styles[id]) != fg
+							|| !SAME_LINES(term.styles[id],
+								term.styles[lines]))
+						break;
+				}
+				end = x + 1;
+			}
 
-			if (term.map[i].ch) {
-				if (term.map[i].fg && term.map[i].fg != term.fg)
-					set_color_fg(term.map[i].fg);
-				else
-					set_fg(term.default_fg);
+			if (term.render == R_XRENDER)
+				xr_draw_run(row, y, start, x, fg);
+			else {
+				if (fg != term.fg)
+					set_fg(fg);
 
-				xcb_poly_text_16_simple(conn, win, gc,
-						term.padding + ((x + 1) * font->width),
-						term.padding + ((y + 1) * font->height),
-						1, &term.map[x + (y * term.width)].ch
-				);
+				draw_run(row, y, start, x);
 			}
+
+			draw_run_lines(row, y, start, end, &term.styles[lines], fg);
 		}
 	}
 
-	if (term.cursor_vis) {
-		set_fg(term.default_fg);
+	term.redraw_pos = term.cursor;
+	term.redraw_pos.y += term.view;
+
+	if (term.cursor_vis && term.redraw_pos.y < term.height) {
 		xcb_rectangle_t rect;
-		rect.x = ((term.cursor.x + 1) * font->width) + term.padding;
-		rect.y = (term.cursor.y * font->height) + term.padding + 2;
+		rect.x = CELL_X(term.redraw_pos.x);
+		rect.y = CELL_Y(term.redraw_pos.y);
 		rect.width = font->width;
 		rect.height = font->height;
-		xcb_poly_fill_rectangle(conn, win, gc, 1, &rect);
+
+		if (term.render == R_SHM)
+			shm_fill(rect.x, rect.y, rect.width, rect.height,
+					term.default_fg);
+		else {
+			if (term.fg != term.default_fg)
+				set_fg(term.default_fg);
+			xcb_poly_fill_rectangle(conn, cur->backbuf, cur->gc, 1, &rect);
+		}
 	}
 
-	xcb_flush(conn);
-	return 0;
-}
-void
-scroll(int dir) {
-	/* add first line to history queue */
-	memmove(term.map, term.map + term.width, term.width * term.height * sizeof(*term.map));
-	cursormv(UP);
-	clrscr(0);
-}
+	if (term.render == R_SHM)
+		shm_put();
 
-void
-cursor_next(struct xt_cursor *curs) {
-	if (curs->x + 1 >= term.width) {
-		curs->y++;
-		curs->x = 0;
-	} else
-		curs->x++;
+	/* show what changed, rows that moved in one piece */
+	if (term.shown0 < term.shown1) {
+		xcb_copy_area(conn, cur->backbuf, cur->win, cur->gc,
+				0, CELL_Y(term.shown0), 0, CELL_Y(term.shown0),
+				term.winsiz.x, (term.shown1 - term.shown0) * font->height);
+	}
 
-	if (curs->y >= term.height)
-		scroll(+1);
+	for (y = 0; y < term.height; y++)
+		if (DIRTY_ISSET(y) && (y < term.shown0 || y >= term.shown1))
+			xcb_copy_area(conn, cur->backbuf, cur->win, cur->gc,
+					CELL_X(term.damage[y].x0), CELL_Y(y),
+					CELL_X(term.damage[y].x0), CELL_Y(y),
+					(term.damage[y].x1 - term.damage[y].x0) * font->width,
+					font->height);
+
+	memset(term.dirty, 0, (term.height + 8) / 8);
+	term.shown0 = term.height;
+	term.shown1 = 0;
+
+	xcb_flush(conn);
+	return 0;
 }
 
 static xcb_keysym_t
 xcb_get_keysym(xcb_keycode_t keycode, uint16_t state)
 {
-	xcb_key_symbols_t *keysyms;
+	xcb_keysym_t keysym;
 
-	if (!(keysyms = xcb_key_symbols_alloc(conn)))
-		return 0;
+	/* numlock, mod2 nearly everywhere, turns the keypad to digits */
+	keysym = xcb_key_symbols_get_keysym(keysyms, keycode, 1);
+	if (state & XCB_MOD_MASK_2 && xcb_is_keypad_key(keysym))
+		return state & XCB_MOD_MASK_SHIFT
+			? xcb_key_symbols_get_keysym(keysyms, keycode, 0) : keysym;
 
-	xcb_keysym_t keysym = xcb_key_symbols_get_keysym(keysyms, keycode, state);
-	xcb_key_symbols_free(keysyms);
+	keysym = xcb_key_symbols_get_keysym(keysyms, keycode,
+			state & XCB_MOD_MASK_SHIFT ? 1 : 0);
+
+	/* caps lock only shifts letters */
+	if (state & XCB_MOD_MASK_LOCK && keysym >= XK_a && keysym <= XK_z)
+		keysym -= XK_a - XK_A;
 
 	return keysym;
 }
 
+/* the codepoint of a keysym, 0 for keys that type no character */
+static uint32_t
+keysym_char(xcb_keysym_t keysym) {
+	size_t lo, hi, mid;
+
+	/* latin-1 keysyms are their codepoint, unicode ones are offset */
+	if (keysym < 0x100)
+		return keysym;
+	if (keysym >= 0x1000100 && keysym <= 0x110ffff)
+		return keysym - 0x1000000;
+
+	for (lo = 0, hi = LEN(keysym_ucs); lo < hi;) {
+		mid = (lo + hi) / 2;
+		if (keysym_ucs[mid].sym == keysym)
+			return keysym_ucs[mid].ucs;
+		if (keysym_ucs[mid].sym < keysym)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+/*
+ * precompute what every 0xffxx keysym sends for each combination of
+ * shift, alt and control, xterm style: CSI code ; 1 + mods ~
+ */
+void
+keytab_init() {
+	struct keyseq *k;
+	size_t i;
+	int m;
+
+	for (m = 0; m < 8; m++) {
+		for (i = 0; i < LEN(fkeys); i++) {
+			k = &keytab[fkeys[i].sym & 0xff][m];
+
+			if (fkeys[i].final != '~' && m)
+				k->len = snprintf(k->s, sizeof(k->s), "\033[1;%d%c",
+						m + 1, fkeys[i].final);
+			else if (fkeys[i].final != '~')
+				k->len = snprintf(k->s, sizeof(k->s), "\033[%c",
+						fkeys[i].final);
+			else if (m)
+				k->len = snprintf(k->s, sizeof(k->s), "\033[%d;%d~",
+						fkeys[i].code, m + 1);
+			else
+				k->len = snprintf(k->s, sizeof(k->s), "\033[%d~",
+						fkeys[i].code);
+		}
+
+		for (i = 0; i < LEN(ckeys); i++) {
+			k = &keytab[ckeys[i].sym & 0xff][m];
+
+			if (m & KEY_CTRL && ckeys[i].ctrl)
+				k->s[k->len++] = ckeys[i].ctrl;
+			else {
+				if (m & KEY_ALT)
+					k->s[k->len++] = '\033';
+				k->s[k->len++] = ckeys[i].c;
+			}
+		}
+	}
+
+	/* back tab */
+	k = &keytab[XK_Tab & 0xff][KEY_SHIFT];
+	k->len = snprintf(k->s, sizeof(k->s), "\033[Z");
+}
+
 struct font_s *
-load_font(xcb_gcontext_t gc, const char *name) {
+load_font(const char *name) {
 	xcb_query_font_cookie_t queryreq;
 	xcb_query_font_reply_t *font_info;
 	xcb_void_cookie_t cookie;
@@ -249,514 +700,571 @@ load_font(xcb_gcontext_t gc, const char *name) {
 	r->char_max = font_info->max_byte1 << 8 | font_info->max_char_or_byte2;
 	r->char_min = font_info->min_byte1 << 8 | font_info->min_char_or_byte2;
 
-	xcb_change_gc(conn, gc, XCB_GC_FONT, &font);
-
-	DEBUG("loaded font '%s'", term.fontline);
+	DEBUG("loaded font '%s'", name);
 
 	free(font_info);
 	return r;
 }
 
-int
-utf_len(char *str) {
-	uint8_t *utf = (uint8_t *)str;
+/*
+ * xrender backend: glyphs are rasterized with the core font into a depth
+ * 8 strip once, read back and kept server side in a glyphset; rows are
+ * then drawn with CompositeGlyphs through a solid fill picture per color
+ */
+void
+xr_init() {
+	const xcb_render_query_pict_formats_reply_t *formats;
+	const xcb_query_extension_reply_t *ext;
+	xcb_render_pictvisual_t *vis;
+	xcb_render_pictforminfo_t *a8;
+	uint16_t ascii[0x7f - 0x20];
+	int i;
 
-	if (utf[0] < 0x80)
-		return 1;
-	else if ((utf[0] & 0xe0) == 0xc0)
-		return 2;
-	else if ((utf[0] & 0xf0) == 0xe0)
-		return 3;
-	else if ((utf[0] & 0xf8) == 0xf0)
-		return 4;
-	else if ((utf[0] & 0xfc) == 0xf8)
-		return 5;
-	else if ((utf[0] & 0xfe) == 0xfc)
-		return 6;
+	ext = xcb_get_extension_data(conn, &xcb_render_id);
+	if (ext == NULL || !ext->present) {
+		DEBUG("no RENDER extension, using core fonts");
+		term.render = R_CORE;
+		return;
+	}
 
-	return 1;
-}
+	formats = xcb_render_util_query_formats(conn);
+	vis = xcb_render_util_find_visual_format(formats, scr->root_visual);
+	a8 = xcb_render_util_find_standard_format(formats, XCB_PICT_STANDARD_A_8);
+	if (vis == NULL || a8 == NULL) {
+		term.render = R_CORE;
+		return;
+	}
 
-uint16_t
-utf_combine(char *str) {
-	uint16_t c;
-	uint8_t *utf = (uint8_t *)str;
+	/* the picture itself follows the back buffer, see backbuf_resize() */
+	xr.format = vis->format;
 
-	switch (utf_len(str)) {
-	case 1:
-		c = utf[0];
-		break;
-	case 2:
-		c = (utf[0] & 0x1f) << 6 | (utf[1] & 0x3f);
-		break;
-	case 3:
-		c = (utf[0] & 0xf) << 12 | (utf[1] & 0x3f) << 6 | (utf[2] & 0x3f);
-		break;
-	case 4:
-	case 5:
-	case 6:
-		c = 0xfffd;
-		break;
-	}
+	xr.glyphs = xcb_generate_id(conn);
+	xcb_render_create_glyph_set(conn, xr.glyphs, a8->id);
+
+	glyph_init();
 
-	return c >> 8 | c << 8;
+	/* most cells are ascii, fetch it in one go */
+	for (i = 0; i < LEN(ascii); i++)
+		ascii[i] = SWAP16(0x20 + i);
+	xr_load(ascii, LEN(ascii));
 }
 
+/* depth 8 strip the core font rasterizes glyphs into for the other backends */
 void
-set_cell(int x, int y, char *str) {
-	uint16_t c;
-	uint8_t *utf = (uint8_t *)str;
-	off_t pos;
-
-	pos = x + (y * term.width);
-	if (pos < 0) {
-		DEBUG("OUT OF BOUNDS!, negative; trying to write to x:%d y:%d", x, y);
-		return;
-	}
-	if (pos > term.width * term.height) {
-		DEBUG("OUT OF BOUNDS!, positive; trying to write to x:%d y:%d", x, y);
-		return;
-	}
+glyph_init() {
+	uint32_t values[3];
+
+	font->strip = xcb_generate_id(conn);
+	xcb_create_pixmap(conn, 8, font->strip, scr->root,
+			GLYPH_BATCH * font->width, font->height);
 
-	c = utf_combine(str);
-	term.map[pos].ch = c;
-	term.map[pos].fg = term.fi;
-	term.map[pos].bg = term.bi;
+	values[0] = 0xff;
+	values[1] = 0;
+	values[2] = font->ptr;
+	font->sgc = xcb_generate_id(conn);
+	xcb_create_gc(conn, font->sgc, font->strip,
+			XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT, values);
 }
 
+/*
+ * rasterize n glyphs, given as CHAR2B, and read them back as width by
+ * height alpha maps packed one after the other into out
+ */
 int
-valid_xy(int x, int y) {
-	if (x + 2 >= term.width || x < 0)
+glyph_fetch(const uint16_t *str, int n, uint8_t *out) {
+	xcb_get_image_reply_t *img;
+	xcb_rectangle_t rect;
+	uint32_t values[1];
+	uint8_t *src;
+	int i, y, stride;
+
+	/* a missing or narrow glyph paints less than its cell */
+	rect.x = rect.y = 0;
+	rect.width = n * font->width;
+	rect.height = font->height;
+	values[0] = 0;
+	xcb_change_gc(conn, font->sgc, XCB_GC_FOREGROUND, values);
+	xcb_poly_fill_rectangle(conn, font->strip, font->sgc, 1, &rect);
+	values[0] = 0xff;
+	xcb_change_gc(conn, font->sgc, XCB_GC_FOREGROUND, values);
+
+	/* one at a time, each at its own cell whatever the advances */
+	for (i = 0; i < n; i++)
+		xcb_image_text_16(conn, 1, font->strip, font->sgc, i * font->width,
+				font->height - font->descent,
+				(const xcb_char2b_t *)str + i);
+
+	img = xcb_get_image_reply(conn, xcb_get_image(conn,
+				XCB_IMAGE_FORMAT_Z_PIXMAP, font->strip, 0, 0,
+				n * font->width, font->height, ~0), NULL);
+	if (img == NULL)
 		return 0;
 
-	if (y > term.height || y < 0)
-		return 0;
+	src = xcb_get_image_data(img);
+	stride = xcb_get_image_data_length(img) / font->height;
 
+	for (i = 0; i < n; i++)
+		for (y = 0; y < font->height; y++)
+			memcpy(out + (i * font->height + y) * font->width,
+					src + y * stride + i * font->width,
+					font->width);
+
+	free(img);
 	return 1;
 }
 
+/* upload n glyphs, given as CHAR2B, into the glyphset */
 void
-sgr(char *buf, size_t n) {
-	int c;
-	char *p;
-	size_t i;
-	int longfmt;
-
-	i = n;
-	p = buf;
-	longfmt = 0;
-
-	n -= 2;
-
-	while (sscanf(p, "%d", &c)) {
-		switch (c) {
-		case 0:
-			term.attr = term.bi = term.fi = 0;
-			break;
-		case 1:
-			term.attr |= BOLD;
-			break;
-		case 30:
-		case 31:
-		case 32:
-		case 33:
-		case 34:
-		case 35:
-		case 36:
-		case 37:
-			term.fi =  term.attr & BOLD ? c - 30 + 8 : c - 30;
-			break;
-		case 38:
-			longfmt = 1;
-			break;
-		case 40:
-		case 41:
-		case 42:
-		case 43:
-		case 44:
-		case 45:
-		case 46:
-		case 47:
-			term.bi =  term.attr & BOLD ? c - 40 + 8 : c - 40;
-			break;
-		case 48:
-			longfmt = 1;
-			break;
-		}
+xr_load(const uint16_t *str, int n) {
+	xcb_render_glyphinfo_t info[GLYPH_BATCH];
+	uint8_t alpha[n * font->width * font->height];
+	uint32_t ids[GLYPH_BATCH];
+	uint8_t *data;
+	int i, y, gstride;
+
+	if (!glyph_fetch(str, n, alpha))
+		return;
 
-		if (longfmt) {
-			int r, g, b, f1, f2, f3, ret;
+	gstride = (font->width + 3) & ~3;
 
-			if (sscanf(p, "%u;%u;%u;%u;%u;%u", &f1, &f2, &f3, &r, &g, &b) > 1) {
+	data = calloc(n, gstride * font->height);
+	if (data == NULL)
+		err(1, "calloc");
 
-				if (f1 != 38)
-					return;
+	for (i = 0; i < n; i++) {
+		ids[i] = SWAP16(str[i]);
+		GLYPH_SET(xr.loaded, ids[i]);
 
-				switch (f2) {
-				case 2:
-					/* XXX: rgb */
-					break;
-				case 5:
-					/* 256 */
-					term.fi = f3;
-					break;
-				}
-			}
-		}
+		info[i].width = font->width;
+		info[i].height = font->height;
+		info[i].x = 0;
+		info[i].y = font->height - font->descent;
+		info[i].x_off = font->width;
+		info[i].y_off = 0;
 
-		while (*p != ';')
-			(void)*p++;
+		for (y = 0; y < font->height; y++)
+			memcpy(data + (i * font->height + y) * gstride,
+					alpha + (i * font->height + y) * font->width,
+					font->width);
 	}
 
-	if (*p == 'm')
-		term.attr = term.bi = term.fi = 0;
-}
+	xcb_render_add_glyphs(conn, xr.glyphs, n, ids, info,
+			n * gstride * font->height, data);
 
-void
-csiseq(char *esc, size_t n) {
-	char *p;
+	free(data);
+}
 
-	p = esc;
+/* solid fill picture for a color, cached by pixel */
+xcb_render_picture_t
+xr_pen(uint32_t pixel) {
+	xcb_render_color_t color;
+	struct pen *p;
 
-	if (p[1] != '[')
-		return;
+	p = &xr.pens[(pixel ^ pixel >> 11) % PENS];
+	if (p->pic && p->pixel == pixel)
+		return p->pic;
 
-	p += 2;
-
-again:
-	switch (p[n]) {
-	case 'A':
-	case 'B':
-	case 'C':
-	case 'D': {
-		int s;
-
-		switch (p[n]) {
-		case 'A':
-		case 'B':
-		case 'C':
-		case 'D':
-			cursormv(p[n]);
-			break;
-		case 'X':
-			if (sscanf(p, "%d", &s))
-				while (s--)
-					cursormv(p[n]);
-			break;
-		}
-	}	break;
-	case 'E':
-	case 'F': {
-		int s;
+	if (p->pic)
+		xcb_render_free_picture(conn, p->pic);
 
-		if (!sscanf(p, "%u", &s))
-			s = 1;
+	color.red = (pixel >> 16 & 0xff) * 0x101;
+	color.green = (pixel >> 8 & 0xff) * 0x101;
+	color.blue = (pixel & 0xff) * 0x101;
+	color.alpha = 0xffff;
 
-		if (p[n] == 'E') {
-			if (valid_xy(term.cursor.x, term.cursor.y + s))
-				term.cursor.y += s;
-		} else if (p[n] == 'F')
-			if (valid_xy(term.cursor.x, term.cursor.y - s))
-				term.cursor.y -= s;
+	p->pixel = pixel;
+	p->pic = xcb_generate_id(conn);
+	xcb_render_create_solid_fill(conn, p->pic, color);
 
-		term.cursor.x = 0;
-	}	break;
-	case 'G': {
-		int s;
+	return p->pic;
+}
 
-		if (!sscanf(p, "%d", &s))
-			s = 1;
+/* same contract as draw_run(), as one CompositeGlyphs16 request */
+void
+xr_draw_run(struct tattr *row, int y, int x0, int x1, uint32_t fg) {
+	uint8_t cmds[(x1 - x0) * 12 + 8];
+	uint16_t miss[GLYPH_BATCH];
+	uint16_t g;
+	int16_t dx, dy;
+	int x, start, n, nmiss, pen;
+	uint8_t *p;
+
+	/* upload what this run needs first */
+	for (x = x0, nmiss = 0; x < x1; x++) {
+		if (!row[x].ch || GLYPH_ISSET(xr.loaded, GLYPH(row[x].ch)))
+			continue;
 
-		if (valid_xy(s, term.cursor.y))
-			term.cursor.x = s;
-	}	break;
-	case 'H': {
-		/* CUP: n ; m H */
-		int row, col;
+		GLYPH_SET(xr.loaded, GLYPH(row[x].ch));
+		miss[nmiss++] = SWAP16(GLYPH(row[x].ch));
+		if (nmiss == GLYPH_BATCH) {
+			xr_load(miss, nmiss);
+			nmiss = 0;
+		}
+	}
+	if (nmiss)
+		xr_load(miss, nmiss);
+
+	/* one element per stretch of filled cells, gaps are pen moves */
+	p = cmds;
+	pen = 0;
+	dy = BASELINE(y);
+	for (x = x0; x < x1;) {
+		if (!row[x].ch) {
+			x++;
+			continue;
+		}
 
-		row = col = 1;
+		for (start = x; x < x1 && row[x].ch && x - start < TEXT_ITEM_MAX; x++)
+			;
 
-		if (memchr(p, ';', n)) /* n + m */
-			sscanf(p, "%d;%d", &row, &col);
-		else /* n only */
-			sscanf(p, "%d", &row);
+		n = x - start;
+		dx = CELL_X(start) - pen;
+		pen = CELL_X(start) + n * font->width;
 
-		row--; col--;
+		p[0] = n;
+		p[1] = p[2] = p[3] = 0;
+		memcpy(p + 4, &dx, 2);
+		memcpy(p + 6, &dy, 2);
+		p += 8;
+		dy = 0;
 
-		if (valid_xy(col, row)) {
-			term.cursor.x = col;
-			term.cursor.y = row;
-			term.wants_redraw = 1;
+		for (; start < x; start++, p += 2) {
+			g = GLYPH(row[start].ch);
+			memcpy(p, &g, 2);
 		}
-	}	break;
-	case 'J': {
-		uint16_t *off;
-		off_t len;
-		struct tattr *mp;
-		mp = term.map + term.cursor.x + (term.cursor.y * term.width);
-
-		DEBUG("clear screen?");
-		switch (p[0]) {
-		case '3': /* clear screen and wipe scrollback */
-			  /* we don't actually have a scrollback buffer yet */
-		case '2': /* clear entire screen */
-			memset(term.map, 0, term.width * term.height * sizeof(*term.map));
-			term.cursor.x = term.cursor.y = 0;
-			break;
-		case '1': { /* clear from cursor to beginning of screen */
-			while (mp-- != term.map)
-				mp->ch = mp->fg = mp->bg = mp->attr = 0;
-
-		}	break;
-		case 'J': /* no arg */
-		case '0': /* clear from cursor to end of screen (default) */
-			while (mp++ != term.map + (term.width * term.height))
-				mp->ch = mp->fg = mp->bg = mp->attr = 0;
 
-			break;
+		if (n & 1) {
+			memset(p, 0, 2);
+			p += 2;
 		}
-	}	break;
-	case 'K': { /* EL erase in line */
-		int s;
-		off_t i, end;
+	}
 
-		sscanf(p, "%d", &s);
-		end = term.width - term.cursor.x;
+	if (p != cmds)
+		xcb_render_composite_glyphs_16(conn, XCB_RENDER_PICT_OP_OVER,
+				xr_pen(fg), cur->pic, 0, xr.glyphs, 0, 0,
+				p - cmds, cmds);
+}
 
-		switch (s) {
-		default:
-		case 0:
-			for (i = term.cursor.x; i < term.width; i++)
-				set_cell(i, term.cursor.y, " ");
+/*
+ * mit-shm backend: rows are rasterized by tem itself into a shared memory
+ * image from a client side atlas of glyph alpha maps, and damaged bands
+ * of scanlines are handed to the server with ShmPutImage
+ */
+void
+shm_init() {
+	const xcb_query_extension_reply_t *ext;
+	xcb_visualtype_t *vis;
+	uint16_t ascii[0x7f - 0x20];
+	union { uint32_t i; uint8_t c; } le = { 1 };
+	int i;
 
-			break;
-		case 1:
-			for (i = term.cursor.x; i; i--)
-				set_cell(i, term.cursor.y, " ");
+	ext = xcb_get_extension_data(conn, &xcb_shm_id);
+	vis = xcb_aux_find_visual_by_id(scr, scr->root_visual);
+
+	/* the kernels below write 0x00rrggbb words in host order */
+	if (ext == NULL || !ext->present || vis == NULL
+			|| vis->red_mask != 0xff0000 || vis->green_mask != 0xff00
+			|| vis->blue_mask != 0xff || scr->root_depth < 24
+			|| xcb_get_setup(conn)->image_byte_order
+				!= (le.c ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST)) {
+		DEBUG("no usable MIT-SHM, using core fonts");
+		term.render = R_CORE;
+		return;
+	}
 
-			break;
-		case 2:
-			for (i = term.cursor.x; i < term.width; i++)
-				set_cell(i, term.cursor.y, " ");
+	shm.event = ext->first_event;
+	glyph_init();
 
-			break;
-		}
-	}	break;
-	case 'M': {/* delete n lines DL? */
-		int s, i;
+	for (i = 0; i < LEN(ascii); i++)
+		ascii[i] = SWAP16(0x20 + i);
+	shm_load(ascii, LEN(ascii));
+}
 
-		if (sscanf(p, "%dM", &s) < 1)
-			s = 1;
+/*
+ * a new image for the window.  a server that cannot attach it, remote or
+ * out of segments, leaves the window to the core backend
+ */
+void
+shm_resize(int width, int height) {
+	xcb_generic_error_t *e;
+	xcb_void_cookie_t cookie;
+	int i;
 
-		for (i = 0; i < term.width; i++)
-			set_cell(i, s, " ");
+	if (cur->img.px != NULL) {
+		xcb_shm_detach(conn, cur->img.seg);
+		shmdt(cur->img.px);
+		cur->img.px = NULL;
+	}
 
-	}	break;
-	case 'S': /* SU scroll up */
-	case 'T': /* SD scroll down */
-		  break;
-	case 'f':
-		p[n] = 'H';
-		goto again;
-	case 'l':
-	case 'h': {
-		int s;
+	/* completions of the old segment are not waited for */
+	cur->img.busy = 0;
+	cur->img.width = width;
+	cur->img.height = height;
 
-		sscanf(p, "?%d", &s);
+	cur->img.id = shmget(IPC_PRIVATE, width * height * 4, IPC_CREAT | 0600);
+	if (cur->img.id < 0) {
+		DEBUG("shmget failed, using core fonts");
+		term.render = R_CORE;
+		return;
+	}
 
-		switch (s) {
-		case 25: /* show or hide cursor */
-			term.cursor_vis = p[n] == 'h';
-			break;
-		case 1049: /* alternative screen buffer */
-		case 2004: /* bracketed paste mode */
-			break;
+	cur->img.px = shmat(cur->img.id, NULL, 0);
+	cur->img.seg = xcb_generate_id(conn);
+	if (cur->img.px != (void *)-1) {
+		cookie = xcb_shm_attach_checked(conn, cur->img.seg, cur->img.id, 1);
+		if ((e = xcb_request_check(conn, cookie)) != NULL) {
+			free(e);
+			shmdt(cur->img.px);
+			cur->img.px = (void *)-1;
 		}
+	}
 
-	}	break;
-	case 'm': {
-		/* sgr */
-		int c;
-		int i;
-
-		for (i = c = 0; i < n; i++)
-			if (p[i] == ';')
-				c++;
+	/* the segment goes away once both sides have detached */
+	shmctl(cur->img.id, IPC_RMID, NULL);
 
-		sgr(p, c);
-	}	break;
-	case 's': /* SCP save cursor position */
-	case 'u': /* RCP restore cursor position */
-		break;
-	case 'd': {
-		int s;
+	if (cur->img.px == (void *)-1) {
+		DEBUG("no shared image, using core fonts");
+		cur->img.px = NULL;
+		term.render = R_CORE;
+		return;
+	}
 
-		if (sscanf(p, "%d", &s) < 0)
-			s = 1;
+	for (i = 0; i < width * height; i++)
+		cur->img.px[i] = term.bg;
+}
 
-		term.cursor.y = s;
-	}	break;
-	case 'L': {
-		int s, i;
+/* copy n glyphs, given as CHAR2B, into the atlas */
+void
+shm_load(const uint16_t *str, int n) {
+	uint8_t alpha[n * font->width * font->height];
+	uint8_t **page;
+	size_t size;
+	int i;
 
-		if (sscanf(p, "%dL", &s))
-			s = 1;
+	if (!glyph_fetch(str, n, alpha))
+		return;
 
-		for (i = 0; i < s; i++)
-			xcb_printf("\n");
-	}	break;
-	case '@':
-		xcb_printf(" ");
-		break;
-	default:
-		DEBUG("unknown escape type: '%lc' (0x%x)", p[n], p[n]);
-		break;
+	size = font->width * font->height;
+	for (i = 0; i < n; i++) {
+		page = &shm.atlas[SWAP16(str[i]) >> 8];
+		if (*page == NULL && (*page = calloc(256, size)) == NULL)
+			err(1, "calloc");
+
+		memcpy(*page + (SWAP16(str[i]) & 0xff) * size, alpha + i * size, size);
+		GLYPH_SET(shm.loaded, SWAP16(str[i]));
 	}
 }
 
+static inline uint32_t
+blend(uint32_t bg, uint32_t fg, uint8_t a) {
+	if (a == 0)
+		return bg;
+	if (a == 0xff)
+		return fg;
+
+	return (((fg & 0xff00ff) * a + (bg & 0xff00ff) * (0xff - a)) >> 8 & 0xff00ff)
+		| (((fg & 0xff00) * a + (bg & 0xff00) * (0xff - a)) >> 8 & 0xff00);
+}
+
 void
-xcb_printf(char *fmt, ...) {
-	va_list args;
-	char buf[BUFSIZ];
-	char *p;
-	size_t n = 0;
-
-	va_start(args, fmt);
-	vsprintf(buf, fmt, args);
-
-	buf[BUFSIZ - 1] = 0;
-
-	p = buf;
-
-	while (*p) {
-		if (term.esc) {
-			//DEBUG("%ld %c", p - buf, *p);
-
-			if (p - buf != 1 && *p != '[')
-				switch (*p) {
-				case '0':
-				case '1':
-				case '2':
-				case '3':
-				case '4':
-				case '5':
-				case '6':
-				case '7':
-				case '8':
-				case '9':
-				case ';':
-				case '?':
-					n++;
-					/* accepted characters */
-					break;
-				case '[':
-					break;
-				default:
-					csiseq(term.esc_str, n);
-					term.esc = 0;
-					break;
-				}
+shm_fill(int px, int py, int w, int h, uint32_t color) {
+	uint32_t *dst;
+	int i;
 
-			(void)*p++;
-			if (p - buf >= BUFSIZ)
-				return;
+	if (px + w > cur->img.width)
+		w = cur->img.width - px;
+	if (py + h > cur->img.height)
+		h = cur->img.height - py;
 
+	for (dst = cur->img.px + py * cur->img.width + px; h > 0;
+			h--, dst += cur->img.width)
+		for (i = 0; i < w; i++)
+			dst[i] = color;
+}
+
+/* rasterize cells x0..x1 of row y into the image */
+void
+shm_draw_row(struct tattr *row, int y, int x0, int x1) {
+	uint16_t miss[GLYPH_BATCH];
+	uint32_t *dst, fg, bg;
+	uint16_t id;
+	uint8_t *a;
+	int x, i, j, w, h, nmiss;
+
+	w = font->width;
+	h = font->height;
+
+	/* clip to whole cells inside the image */
+	if (CELL_Y(y) + h > cur->img.height)
+		return;
+	if (x1 > (cur->img.width - CELL_X(0)) / w)
+		x1 = (cur->img.width - CELL_X(0)) / w;
+
+	for (x = x0, nmiss = 0; x < x1; x++) {
+		if (!row[x].ch || GLYPH_ISSET(shm.loaded, GLYPH(row[x].ch)))
 			continue;
+
+		GLYPH_SET(shm.loaded, GLYPH(row[x].ch));
+		miss[nmiss++] = SWAP16(GLYPH(row[x].ch));
+		if (nmiss == GLYPH_BATCH) {
+			shm_load(miss, nmiss);
+			nmiss = 0;
+		}
+	}
+	if (nmiss)
+		shm_load(miss, nmiss);
+
+	id = row[x0].style;
+	fg = style_fg(&term.styles[id]);
+	bg = style_bg(&term.styles[id]);
+	for (x = x0; x < x1; x++) {
+		if (row[x].style != id) {
+			id = row[x].style;
+			fg = style_fg(&term.styles[id]);
+			bg = style_bg(&term.styles[id]);
 		}
 
-		switch (*p) {
-		case '\a':
-			/* ignore */
-			break;
-		case '\t': {
-			int i;
-
-			for (i = 0; i < 8 - (term.cursor.x % 8); i++)
-				;
-
-			xcb_printf("%*s", i, "");
-		 }	break;
-		case '\b':
-			if (valid_xy(term.cursor.x - 1, term.cursor.y ))
-				clr_cell(term.cursor.x - 1, term.cursor.y);
-			cursormv(LEFT);
-			break;
-		case '\r':
-			term.cursor.x = 0;
-			break;
-		case '\n':
-			cursormv(DOWN);
-			//if (valid_xy(term.cursor.x, term.cursor.y + 1))
-			//	term.cursor.y++;
-			break;
-		case 0x1b:
-			term.esc = 1;
-			term.esc_str = p;
-			n = 0;
-			break;
-		case ' ':
-			if (valid_xy(term.cursor.x, term.cursor.y)) {
-				clr_cell(term.cursor.x, term.cursor.y);
-				cursor_next(&term.cursor);
-			}
-			break;
-		default:
-			if (valid_xy(term.cursor.x, term.cursor.y)) {
-				set_cell(term.cursor.x, term.cursor.y, p);
-				cursor_next(&term.cursor);
-			}
-			break;
+		if (!row[x].ch || shm.atlas[GLYPH(row[x].ch) >> 8] == NULL) {
+			shm_fill(CELL_X(x), CELL_Y(y), w, h, bg);
+
+			/* the right half of a wide character */
+			if (row[x].flags & WDUMMY)
+				draw_lines(y, x, x + 1, &term.styles[id], fg);
+			continue;
 		}
 
-		p += utf_len(p);
+		a = shm.atlas[GLYPH(row[x].ch) >> 8]
+			+ (GLYPH(row[x].ch) & 0xff) * w * h;
+		dst = cur->img.px + CELL_Y(y) * cur->img.width + CELL_X(x);
+
+		for (j = 0; j < h; j++, dst += cur->img.width, a += w)
+			for (i = 0; i < w; i++)
+				dst[i] = blend(bg, fg, a[i]);
+
+		draw_lines(y, x, x + 1, &term.styles[id], fg);
 	}
 }
 
+/* push each band of consecutive damaged rows with one ShmPutImage */
+void
+shm_put() {
+	int y, y0, x0, x1, px, pw;
+
+	for (y = 0; y < term.height; y++) {
+		if (!DIRTY_ISSET(y))
+			continue;
+
+		x0 = term.damage[y].x0;
+		x1 = term.damage[y].x1;
+		for (y0 = y; y + 1 < term.height && DIRTY_ISSET(y + 1); y++) {
+			if (term.damage[y + 1].x0 < x0)
+				x0 = term.damage[y + 1].x0;
+			if (term.damage[y + 1].x1 > x1)
+				x1 = term.damage[y + 1].x1;
+		}
+
+		px = CELL_X(x0);
+		pw = (x1 - x0) * font->width;
+		if (px + pw > cur->img.width)
+			pw = cur->img.width - px;
+		if (pw <= 0 || CELL_Y(y + 1) > cur->img.height)
+			continue;
+
+		xcb_shm_put_image(conn, cur->backbuf, cur->gc,
+				cur->img.width, cur->img.height,
+				px, CELL_Y(y0), pw, (y - y0 + 1) * font->height,
+				px, CELL_Y(y0), scr->root_depth,
+				XCB_IMAGE_FORMAT_Z_PIXMAP, 1, cur->img.seg, 0);
+		cur->img.busy++;
+		cur->img.sent = msnow();
+	}
+}
+
+/*
+ * the window's image is still being read.  a completion that never
+ * comes must not stop the window for good, so it is given up on after
+ * SHM_TIMEOUT
+ */
+int
+shm_busy(long long now) {
+	if (cur->img.busy && now - cur->img.sent >= SHM_TIMEOUT)
+		cur->img.busy = 0;
+
+	return cur->img.busy;
+}
+
+/* everything is drawn into backbuf, the window is only copied to */
+void
+backbuf_resize() {
+	if (cur->backbuf) {
+		xcb_free_pixmap(conn, cur->backbuf);
+		if (cur->pic)
+			xcb_render_free_picture(conn, cur->pic);
+	}
+
+	cur->backbuf = xcb_generate_id(conn);
+	xcb_create_pixmap(conn, scr->root_depth, cur->backbuf, cur->win,
+			term.winsiz.x, term.winsiz.y);
+
+	if (term.render == R_XRENDER) {
+		cur->pic = xcb_generate_id(conn);
+		xcb_render_create_picture(conn, cur->pic, cur->backbuf,
+				xr.format, 0, NULL);
+	}
+
+	if (term.render == R_SHM)
+		shm_resize(term.winsiz.x, term.winsiz.y);
+}
+
 void
 resize(int x, int y) {
 	uint32_t values[3];
 	uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-	struct tattr *rmap;
 	struct winsize ws;
-	int i;
 
-	values[0] = (term.padding * 2) + font->width * (x - 1);
-	values[1] = (term.padding * 2) + font->height * (y - 1);
+	values[0] = (term.padding * 2) + font->width * x;
+	values[1] = (term.padding * 2) + font->height * y;
 
-	xcb_configure_window(conn, win, mask, values);
+	xcb_configure_window(conn, cur->win, mask, values);
 
-	rmap = malloc(sizeof(struct tattr) * (x * (y + 1)));
-	if (rmap == NULL)
-		err(1, "malloc");
-
-	memset(rmap, 0, x * y * sizeof(*rmap));
+	term_resize(x, y);
+	ws.ws_col = x;
+	ws.ws_row = y;
 
-	if (term.map != NULL) {
-		memcpy(rmap, term.map, term.width * term.height);
-		free(term.map);
-	}
+	term.winsiz.x = (term.padding * 2) + font->width * x;
+	term.winsiz.y = (term.padding * 2) + font->height * y;
 
-	ws.ws_col = term.width = x;
-	term.height = y - 1;
-	ws.ws_row  = y;
-	term.map = rmap;
-	term.winsiz.x = (term.padding * 2) + font->width * (x - 1);
-	term.winsiz.y = (term.padding * 2) + font->height * (y - 1);
+	backbuf_resize();
+	term.shown0 = term.height;
+	term.shown1 = 0;
+	clrscr();
+	damage_all();
 
-	(void)ioctl(d, TIOCSWINSZ, &ws);
+	(void)ioctl(cur->pty, TIOCSWINSZ, &ws);
 	(void)kill(term.pid, SIGWINCH);
 }
 
+int
+render_byname(const char *name) {
+	if (strcmp(name, "core") == 0)
+		return R_CORE;
+	if (strcmp(name, "shm") == 0)
+		return R_SHM;
+
+	return R_XRENDER;
+}
+
 void
 load_config() {
 	xcb_xrm_database_t *db;
 	char *xrm_buf;
+	long l;
 
 	db = xcb_xrm_database_from_default(conn);
 	if (db != NULL) {
 		xcb_xrm_resource_get_string(db, "xt.font", NULL, &xrm_buf);
 		if (xrm_buf != NULL) {
-			strncpy(term.fontline, xrm_buf, BUFSIZ);
+			strncpy(fontline, xrm_buf, BUFSIZ - 1);
 			free(xrm_buf);
 		}
 
@@ -766,7 +1274,7 @@ load_config() {
 			if (xrm_buf[0] == '#')
 				xrm_buf[0] = ' ';
 
-			term.fg = strtoul(xrm_buf, NULL, 16);
+			term.fg = term.default_fg = strtoul(xrm_buf, NULL, 16);
 			free(xrm_buf);
 		}
 
@@ -776,7 +1284,19 @@ load_config() {
 			if (xrm_buf[0] == '#')
 				xrm_buf[0] = ' ';
 
-			term.bg = strtoul(xrm_buf, NULL, 16);
+			term.bg = term.default_bg = strtoul(xrm_buf, NULL, 16);
+			free(xrm_buf);
+		}
+
+		if (xcb_xrm_resource_get_long(db, "xt.scrollback", NULL, &l) == 0)
+			term.hist.max = l;
+
+		if (xcb_xrm_resource_get_long(db, "xt.frameInterval", NULL, &l) == 0)
+			term.frame_ms = l;
+
+		xcb_xrm_resource_get_string(db, "xt.render", NULL, &xrm_buf);
+		if (xrm_buf != NULL) {
+			term.render = render_byname(xrm_buf);
 			free(xrm_buf);
 		}
 	}
@@ -785,114 +1305,1129 @@ load_config() {
 }
 
 void
-clrscr(int ln) {
-	xcb_clear_area(conn, 0, win, 0,
-			(term.padding) + ln * font->height,
-			(term.padding * 2) + term.width * font->width,
-			(term.padding * 2) + term.height * font->height
-	);
+clrscr() {
+	xcb_rectangle_t rect;
+
+	rect.x = rect.y = 0;
+	rect.width = term.winsiz.x;
+	rect.height = term.winsiz.y;
+	xcb_poly_fill_rectangle(conn, cur->backbuf, cur->bgc, 1, &rect);
+
+	if (term.render == R_SHM && cur->img.px != NULL)
+		shm_fill(0, 0, cur->img.width, cur->img.height, term.bg);
 }
 
 void
-buttonpress(uint16_t x, uint16_t y) {
-	int row, col;
+key_send(const char *s, size_t n) {
+	/* typing snaps the viewport back to the live screen */
+	view_scroll(-term.view);
 
-	col = (term.padding + x) / font->width;
-	row = (term.padding + y) / font->height;
-	col = ((term.padding + x) / font->width) - 1;
-	row = ((term.padding + y) / font->height) - 1;
+	tty_write(&cur->tty, s, n);
+}
+
+/* intern all of atom_names with one round trip */
+void
+atoms_init() {
+	xcb_intern_atom_cookie_t c[NATOMS];
+	xcb_intern_atom_reply_t *r;
+	int i;
 
-	row--; col--;
+	for (i = 0; i < NATOMS; i++)
+		c[i] = xcb_intern_atom(conn, 0, strlen(atom_names[i]),
+				atom_names[i]);
 
-	DEBUG("x:%d y:%d", col, row);
+	for (i = 0; i < NATOMS; i++) {
+		if ((r = xcb_intern_atom_reply(conn, c[i], NULL)) == NULL)
+			errx(1, "xcb_intern_atom %s", atom_names[i]);
+		atoms[i] = r->atom;
+		free(r);
+	}
 }
 
+/* ask the owner of sel for its text, it arrives with SelectionNotify */
 void
-keypress(xcb_keycode_t keycode, uint16_t state) {
-	xcb_keysym_t keysym;
-	xcb_keysym_t key;
+paste_request(xcb_atom_t sel) {
+	xcb_convert_selection(conn, cur->win, sel, atoms[A_UTF8_STRING],
+			atoms[A_TEM_PASTE], XCB_CURRENT_TIME);
+}
 
-	keysym = xcb_get_keysym(keycode, state);
-	key = xcb_get_keysym(keycode, 0);
+/* pasted text goes to the child like typed text, newlines as returns */
+void
+paste_text(char *s, size_t n) {
+	size_t i;
 
-	if (state & XCB_MOD_MASK_CONTROL) {
-		DEBUG("ctrl + %lc (%d)", key, key - 0x60);
+	for (i = 0; i < n; i++)
+		if (s[i] == '\n')
+			s[i] = '\r';
 
-		if (isalpha(key))
-			dprintf(d, "%lc", key - 0x60);
+	key_send(s, n);
+}
 
-		return;
+void
+paste_begin() {
+	cur->paste.bracketed = term.bracketed;
+	if (cur->paste.bracketed)
+		key_send("\033[200~", 6);
+}
+
+void
+paste_end() {
+	if (cur->paste.bracketed)
+		key_send("\033[201~", 6);
+	cur->paste.incr = cur->paste.held = 0;
+}
+
+/*
+ * move what the selection owner put in our property to the pty.  a large
+ * selection comes INCR, one piece per property change: deleting the
+ * property asks for the next, so while the child is slow to read the
+ * delete is held back and the owner waits
+ */
+void
+paste_read() {
+	xcb_get_property_reply_t *r;
+	uint32_t off;
+	int n, more;
+
+	for (off = 0, more = 1; more; off += n / 4) {
+		r = xcb_get_property_reply(conn, xcb_get_property(conn, 0, cur->win,
+					atoms[A_TEM_PASTE], XCB_GET_PROPERTY_TYPE_ANY,
+					off, PASTE_CHUNK / 4), NULL);
+		if (r == NULL)
+			return;
+
+		if (r->type == atoms[A_INCR]) {
+			free(r);
+			cur->paste.incr = 1;
+			paste_begin();
+			xcb_delete_property(conn, cur->win, atoms[A_TEM_PASTE]);
+			return;
+		}
+
+		n = xcb_get_property_value_length(r);
+		more = r->bytes_after > 0;
+
+		if (off == 0 && !cur->paste.incr)
+			paste_begin();
+		if (off == 0 && cur->paste.incr && n == 0) {
+			/* the empty piece ends it */
+			free(r);
+			xcb_delete_property(conn, cur->win, atoms[A_TEM_PASTE]);
+			paste_end();
+			return;
+		}
+
+		paste_text(xcb_get_property_value(r), n);
+		free(r);
 	}
 
-	switch (keysym) {
-	case XK_Alt_L:
-	case XK_Alt_R:
-	case XK_Super_L:
-	case XK_Super_R:
-	case XK_Shift_L:
-	case XK_Shift_R:
-	case XK_Hyper_L:
-	case XK_Hyper_R:
-	case XK_Control_L:
-	case XK_Control_R:
-		/* lone modifiers, do nothing */
-		break;
-	case XK_Tab:
-		dprintf(d, "\t");
-		break;
-	case XK_Escape:
-		dprintf(d, "\033");
-		break;
-	case XK_Up:
-		dprintf(d, "\033OA");
-		break;
-	case XK_Down:
-		dprintf(d, "\033OB");
-		break;
-	case XK_Right:
-		dprintf(d, "\033OC");
-		break;
-	case XK_Left:
-		dprintf(d, "\033OD");
+	if (!cur->paste.incr) {
+		xcb_delete_property(conn, cur->win, atoms[A_TEM_PASTE]);
+		paste_end();
+	} else if (cur->tty.outlen > PASTE_HIGH)
+		cur->paste.held = 1;
+	else
+		xcb_delete_property(conn, cur->win, atoms[A_TEM_PASTE]);
+}
+
+/* the pty took some input, let a held INCR paste go on */
+void
+paste_resume() {
+	if (cur->paste.held && cur->tty.outlen <= PASTE_HIGH / 2) {
+		cur->paste.held = 0;
+		xcb_delete_property(conn, cur->win, atoms[A_TEM_PASTE]);
+	}
+}
+
+/* the cell under pixel px, py of the window, kept on the grid */
+void
+cell_at(int px, int py, int *x, int *y) {
+	*x = (px - term.padding) / font->width;
+	*y = (py - term.padding) / font->height;
+
+	if (*x < 0)
+		*x = 0;
+	if (*x >= term.width)
+		*x = term.width - 1;
+	if (*y < 0)
+		*y = 0;
+	if (*y >= term.height)
+		*y = term.height - 1;
+}
+
+void
+buttonpress(xcb_button_press_event_t *e) {
+	int x, y;
+
+	switch (e->detail) {
+	case XCB_BUTTON_INDEX_1:
+		cell_at(e->event_x, e->event_y, &x, &y);
+
+		/* quick presses on one cell select a word, then the line */
+		if (e->time - cur->click.time < CLICK_MS
+				&& x == cur->click.x && y == cur->click.y)
+			cur->click.n = cur->click.n % 3 + 1;
+		else
+			cur->click.n = 1;
+		cur->click.time = e->time;
+		cur->click.x = x;
+		cur->click.y = y;
+
+		sel_start(&term.sel, x, y, cur->click.n == 1 ? SEL_CHAR
+				: cur->click.n == 2 ? SEL_WORD : SEL_LINE);
 		break;
-	case XK_BackSpace: /* backspace */
-		dprintf(d, "\b");
+	case XCB_BUTTON_INDEX_2:
+		paste_request(XCB_ATOM_PRIMARY);
 		break;
-	case XK_Return:
-		dprintf(d, "\n");
+	case XCB_BUTTON_INDEX_4:
+		view_scroll(HIST_WHEEL);
 		break;
-	default:
-		//xcb_printf("%lc", keysym);
-		//DEBUG("unknown keysym: '%lc' (0x%x)", keysym, keysym);
-		dprintf(d, "%lc", keysym);
+	case XCB_BUTTON_INDEX_5:
+		view_scroll(-HIST_WHEEL);
 		break;
 	}
 }
 
+/* send text to w INCR, SEL_CHUNK at a time as the requestor asks */
+void
+xfer_start(xcb_window_t w, xcb_atom_t prop, xcb_atom_t type, char *text,
+		size_t len) {
+	struct xfer *x;
+	uint32_t v;
+	int i;
+
+	/* a free slot, else the transfers still going give way in turn */
+	for (i = 0; i < SEL_XFERS && xfers[i].text != NULL; i++)
+		;
+	if (i == SEL_XFERS) {
+		i = nxfer;
+		nxfer = (nxfer + 1) % SEL_XFERS;
+	}
+
+	x = &xfers[i];
+	free(x->text);
+	x->win = w;
+	x->prop = prop;
+	x->type = type;
+	x->text = text;
+	x->len = len;
+	x->off = 0;
+
+	/* hear of the deletes, our own windows already tell us */
+	if (win_find(w) == NULL) {
+		v = XCB_EVENT_MASK_PROPERTY_CHANGE;
+		xcb_change_window_attributes(conn, w, XCB_CW_EVENT_MASK, &v);
+	}
+
+	v = len > UINT32_MAX ? UINT32_MAX : len;
+	xcb_change_property(conn, XCB_PROP_MODE_REPLACE, w, prop, atoms[A_INCR],
+			32, 1, &v);
+}
+
+/* prop of w was deleted, a requestor wants the next piece */
+void
+xfer_next(xcb_window_t w, xcb_atom_t prop) {
+	struct xfer *x;
+	size_t n;
+	int i;
+
+	for (i = 0; i < SEL_XFERS; i++) {
+		x = &xfers[i];
+		if (x->text == NULL || x->win != w || x->prop != prop)
+			continue;
+
+		n = x->len - x->off;
+		if (n > sel_chunk)
+			n = sel_chunk;
+		xcb_change_property(conn, XCB_PROP_MODE_REPLACE, w, prop, x->type,
+				8, n, x->text + x->off);
+		x->off += n;
+
+		/* the empty piece ends it */
+		if (n == 0) {
+			free(x->text);
+			x->text = NULL;
+		}
+	}
+}
+
+/*
+ * STRING is iso 8859-1, so the utf-8 of sel_text(), whole sequences only,
+ * is narrowed in place; what latin-1 has no room for becomes '?'
+ */
+size_t
+latin1(char *text, size_t len) {
+	size_t i, n;
+	uint32_t c;
+	int l;
+
+	/* n never passes i, but may land on the lead byte */
+	for (i = n = 0; i < len; i += l) {
+		l = utf_len(text + i);
+		c = utf_combine(text + i);
+		text[n++] = c < 0x100 ? c : '?';
+	}
+
+	return n;
+}
+
+/*
+ * someone wants PRIMARY or CLIPBOARD, which we own.  only now is the text
+ * extracted, and what does not fit a request goes INCR
+ */
+void
+sel_request(xcb_selection_request_event_t *e) {
+	xcb_atom_t targets[] = {
+		atoms[A_TARGETS], atoms[A_UTF8_STRING], XCB_ATOM_STRING
+	};
+	xcb_selection_notify_event_t n;
+	struct xt_sel *s;
+	xcb_atom_t prop;
+	size_t len;
+	char *text;
+
+	memset(&n, 0, sizeof(n));
+	n.response_type = XCB_SELECTION_NOTIFY;
+	n.time = e->time;
+	n.requestor = e->requestor;
+	n.selection = e->selection;
+	n.target = e->target;
+	n.property = XCB_NONE;	/* refused, unless it is set below */
+
+	/* obsolete clients name no property and get the target */
+	prop = e->property != XCB_NONE ? e->property : e->target;
+
+	if (e->selection == XCB_ATOM_PRIMARY)
+		s = &term.sel;
+	else if (e->selection == atoms[A_CLIPBOARD])
+		s = &term.clip;
+	else
+		s = NULL;
+
+	if (s != NULL && s->on) {
+		if (e->target == atoms[A_TARGETS]) {
+			xcb_change_property(conn, XCB_PROP_MODE_REPLACE,
+					e->requestor, prop, XCB_ATOM_ATOM, 32,
+					LEN(targets), targets);
+			n.property = prop;
+		} else if (e->target == atoms[A_UTF8_STRING]
+				|| e->target == XCB_ATOM_STRING) {
+			text = sel_text(s, &len);
+			if (e->target == XCB_ATOM_STRING)
+				len = latin1(text, len);
+			if (len > sel_chunk)
+				xfer_start(e->requestor, prop, e->target, text, len);
+			else {
+				xcb_change_property(conn, XCB_PROP_MODE_REPLACE,
+						e->requestor, prop, e->target, 8, len, text);
+				free(text);
+			}
+			n.property = prop;
+		}
+	}
+
+	xcb_send_event(conn, 0, e->requestor, XCB_EVENT_MASK_NO_EVENT,
+			(const char *)&n);
+}
+
+void
+keypress(xcb_keycode_t keycode, uint16_t state) {
+	xcb_keysym_t keysym;
+	struct keyseq *k;
+	char buf[8];
+	uint32_t c;
+	size_t i;
+	int m, n;
+
+	keysym = xcb_get_keysym(keycode, state);
+
+	if (state & XCB_MOD_MASK_SHIFT) {
+		switch (keysym) {
+		case XK_Prior:
+			view_scroll(term.height / 2);
+			return;
+		case XK_Next:
+			view_scroll(-term.height / 2);
+			return;
+		case XK_Insert:
+			paste_request(XCB_ATOM_PRIMARY);
+			return;
+		case XK_V:
+			if (state & XCB_MOD_MASK_CONTROL) {
+				paste_request(atoms[A_CLIPBOARD]);
+				return;
+			}
+			break;
+		case XK_C:
+			if (state & XCB_MOD_MASK_CONTROL) {
+				/* the clipboard keeps this selection, whatever comes */
+				term.clip = term.sel;
+				if (term.clip.on)
+					xcb_set_selection_owner(conn, cur->win,
+							atoms[A_CLIPBOARD], evtime);
+				return;
+			}
+			break;
+		}
+	}
+
+	m = (state & XCB_MOD_MASK_SHIFT ? KEY_SHIFT : 0)
+		| (state & XCB_MOD_MASK_1 ? KEY_ALT : 0)
+		| (state & XCB_MOD_MASK_CONTROL ? KEY_CTRL : 0);
+
+	/* shift+tab comes as a keysym of its own, send it as the back tab */
+	if (keysym == XK_ISO_Left_Tab) {
+		keysym = XK_Tab;
+		m |= KEY_SHIFT;
+	}
+
+	/* the keypad goes as the keys it copies */
+	if (keysym >= XK_KP_Space && keysym <= XK_KP_Equal)
+		for (i = 0; i < LEN(kpkeys); i++)
+			if (kpkeys[i].sym == keysym) {
+				keysym = kpkeys[i].as;
+				break;
+			}
+
+	/* function and editing keys, lone modifiers map to nothing */
+	if ((keysym & 0xff00) == 0xff00) {
+		k = &keytab[keysym & 0xff][m];
+		if (k->len)
+			key_send(k->s, k->len);
+		return;
+	}
+
+	if ((c = keysym_char(keysym)) == 0)
+		return;
+
+	n = 0;
+	if (m & KEY_ALT)
+		buf[n++] = '\033';
+
+	if (m & KEY_CTRL && c == ' ')
+		buf[n++] = 0;
+	else if (m & KEY_CTRL && c >= '@' && c <= '~')
+		buf[n++] = c & 0x1f;
+	else
+		n += utf_encode(c, buf + n);
+
+	key_send(buf, n);
+}
+
+long long
+msnow() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * parse what the reader thread has queued until the ring runs dry or
+ * PARSE_BUDGET is spent, then look at what is left to decide whether to
+ * jump scroll
+ */
+void
+pty_drain() {
+	long long start;
+	const char *p;
+	size_t n;
+
+	start = msnow();
+
+	while ((n = tty_peek(&cur->tty, &p)) > 0) {
+		if (n > READ_MAX)
+			n = READ_MAX;
+
+		term_write(p, n);
+		tty_consume(&cur->tty, n);
+
+		if (msnow() - start >= PARSE_BUDGET)
+			break;
+	}
+
+	if (tty_done(&cur->tty))
+		term.ttydead = 1;
+
+	term.jump = tty_queued(&cur->tty) > JUMP_BACKLOG;
+}
+
+/*
+ * render at most once per frame interval, right away after a keypress so
+ * echo is not delayed, and only every JUMP_INTERVAL while jump scrolling
+ */
+int
+frame_due(long long now) {
+	if (!term.wants_redraw)
+		return 0;
+
+	/* the server is still reading the image we would draw into */
+	if (term.render == R_SHM && shm_busy(now))
+		return 0;
+
+	if (term.urgent)
+		return 1;
+
+	if (term.jump)
+		return now - term.last_frame >= JUMP_INTERVAL;
+
+	return now - term.last_frame >= term.frame_ms;
+}
+
 void
 cleanup() {
 	DEBUG("cleanup");
 	term.ttydead = 1;
 }
 
+/* the window an event is about, which need not be one of ours */
+xcb_window_t
+ev_window(xcb_generic_event_t *ev) {
+	switch (ev->response_type & ~0x80) {
+	case XCB_EXPOSE:
+		return ((xcb_expose_event_t *)ev)->window;
+	case XCB_KEY_PRESS:
+		return ((xcb_key_press_event_t *)ev)->event;
+	case XCB_BUTTON_PRESS:
+	case XCB_BUTTON_RELEASE:
+		return ((xcb_button_press_event_t *)ev)->event;
+	case XCB_MOTION_NOTIFY:
+		return ((xcb_motion_notify_event_t *)ev)->event;
+	case XCB_SELECTION_REQUEST:
+		return ((xcb_selection_request_event_t *)ev)->owner;
+	case XCB_SELECTION_CLEAR:
+		return ((xcb_selection_clear_event_t *)ev)->owner;
+	case XCB_SELECTION_NOTIFY:
+		return ((xcb_selection_notify_event_t *)ev)->requestor;
+	case XCB_PROPERTY_NOTIFY:
+		return ((xcb_property_notify_event_t *)ev)->window;
+	case XCB_CONFIGURE_NOTIFY:
+		return ((xcb_configure_notify_event_t *)ev)->window;
+	case XCB_CLIENT_MESSAGE:
+		return ((xcb_client_message_event_t *)ev)->window;
+	}
+
+	return XCB_NONE;
+}
+
+/* handle one X event, in the window it is for */
+void
+x_event(xcb_generic_event_t *ev) {
+	struct win_s *w;
+
+	/* each window waits for the puts of its own image */
+	if (conf.render == R_SHM
+			&& (ev->response_type & ~0x80) == shm.event + XCB_SHM_COMPLETION) {
+		xcb_shm_completion_event_t *e = (xcb_shm_completion_event_t *)ev;
+
+		for (w = wins; w != NULL; w = w->next)
+			if (w->img.px != NULL && w->img.seg == e->shmseg
+					&& w->img.busy > 0)
+				w->img.busy--;
+		return;
+	}
+
+	switch (ev->response_type & ~0x80) {
+	case XCB_MAPPING_NOTIFY:
+		xcb_refresh_keyboard_mapping(keysyms,
+				(xcb_mapping_notify_event_t *)ev);
+		return;
+	case XCB_PROPERTY_NOTIFY: {
+		xcb_property_notify_event_t *e = (xcb_property_notify_event_t *)ev;
+
+		/* a requestor of any window took a piece of a selection */
+		if (e->state == XCB_PROPERTY_DELETE) {
+			xfer_next(e->window, e->atom);
+			return;
+		}
+	} break;
+	}
+
+	if ((w = win_find(ev_window(ev))) == NULL)
+		return;
+	win_select(w);
+
+	switch (ev->response_type & ~0x80) {
+	case XCB_EXPOSE: {
+		xcb_expose_event_t *e = (xcb_expose_event_t *)ev;
+
+		xcb_copy_area(conn, cur->backbuf, cur->win, cur->gc, e->x, e->y,
+				e->x, e->y, e->width, e->height);
+		if (e->count == 0)
+			xcb_flush(conn);
+	} break;
+	case XCB_KEY_PRESS: {
+		xcb_key_press_event_t *e = (xcb_key_press_event_t *)ev;
+		evtime = e->time;
+		keypress(e->detail, e->state);
+		term.urgent = 1;
+	} break;
+	case XCB_BUTTON_PRESS:
+		buttonpress((xcb_button_press_event_t *)ev);
+		break;
+	case XCB_MOTION_NOTIFY: {
+		xcb_motion_notify_event_t *e = (xcb_motion_notify_event_t *)ev;
+		int x, y;
+
+		/* only reported while button 1 is down */
+		cell_at(e->event_x, e->event_y, &x, &y);
+		sel_extend(&term.sel, x, y);
+	} break;
+	case XCB_BUTTON_RELEASE: {
+		xcb_button_release_event_t *e = (xcb_button_release_event_t *)ev;
+
+		if (e->detail == XCB_BUTTON_INDEX_1 && term.sel.on)
+			xcb_set_selection_owner(conn, cur->win, XCB_ATOM_PRIMARY,
+					e->time);
+	} break;
+	case XCB_SELECTION_REQUEST:
+		sel_request((xcb_selection_request_event_t *)ev);
+		break;
+	case XCB_SELECTION_CLEAR: {
+		xcb_selection_clear_event_t *e = (xcb_selection_clear_event_t *)ev;
+
+		/* another client selected, ours is not shown any more */
+		if (e->selection == XCB_ATOM_PRIMARY)
+			sel_clear(&term.sel);
+		else if (e->selection == atoms[A_CLIPBOARD])
+			term.clip.on = 0;
+	} break;
+	case XCB_SELECTION_NOTIFY: {
+		xcb_selection_notify_event_t *e = (xcb_selection_notify_event_t *)ev;
+
+		/* NONE when the owner could not convert it */
+		if (e->property == atoms[A_TEM_PASTE])
+			paste_read();
+	} break;
+	case XCB_PROPERTY_NOTIFY: {
+		xcb_property_notify_event_t *e = (xcb_property_notify_event_t *)ev;
+
+		if (cur->paste.incr && e->atom == atoms[A_TEM_PASTE])
+			paste_read();
+	} break;
+	case XCB_CLIENT_MESSAGE: {
+		xcb_client_message_event_t *e = (xcb_client_message_event_t *)ev;
+
+		/* closed by the window manager, hang up on the child */
+		if (e->type == atoms[A_WM_PROTOCOLS]
+				&& e->data.data32[0] == atoms[A_WM_DELETE_WINDOW])
+			term.ttydead = 1;
+	} break;
+	case XCB_CONFIGURE_NOTIFY: {
+		xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *)ev;
+
+		if (term.winsiz.x != e->width || term.winsiz.y != e->height)
+			if (e->width > 3 * font->width && e->height > 3 * font->height)
+				resize((e->width - 2 * term.padding) / font->width,
+						(e->height - 2 * term.padding) / font->height);
+	}	break;
+	default:
+		DEBUG("unknown event %d", ev->response_type & ~0x80);
+	}
+}
+
+/* handle every event queued on the connection, -1 once it is broken */
 int
-main(int argc, char **argv) {
-	uint32_t mask;
+x_events() {
+	xcb_generic_event_t *ev;
+
+	while ((ev = xcb_poll_for_event(conn)) != NULL) {
+		x_event(ev);
+		free(ev);
+	}
+
+	return xcb_connection_has_error(conn) ? -1 : 0;
+}
+
+/* start the shell on a new pty for the current window, in dir if given */
+void
+win_spawn(const char *dir) {
+	char *args[] = { "sh", NULL };
+	char nodir[PATH_MAX + 32], noexec[PATH_MAX + 32];
+	struct termios tio;
+	sigset_t none;
+	char **env;
+	int i, n;
+
+	/*
+	 * the reader threads of other windows may hold locks across the
+	 * fork, so the child only makes async-signal-safe calls; all it
+	 * needs is set up here
+	 */
+	if ((term.shell = getenv("SHELL")) == NULL || term.shell[0] == '\0')
+		term.shell = SHELL;
+
+	for (n = 0; environ[n] != NULL; n++)
+		;
+	if ((env = calloc(n + 2, sizeof(*env))) == NULL)
+		err(1, "calloc");
+	for (i = n = 0; environ[i] != NULL; i++)
+		if (strncmp(environ[i], "TERM=", 5) != 0)
+			env[n++] = environ[i];
+	env[n] = "TERM=tem-256color";
+
+	snprintf(nodir, sizeof(nodir), "tem: %s: cannot enter\n", dir ? dir : "");
+	snprintf(noexec, sizeof(noexec), "tem: %s: cannot run\n", term.shell);
+
+	term.pid = forkpty(&cur->pty, NULL, NULL, NULL);
+	if (term.pid < 0)
+		err(1, "forkpty");
+
+	if (term.pid == 0) {
+		/* child */
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		if (dir != NULL && dir[0] && chdir(dir) < 0)
+			(void)write(STDERR_FILENO, nodir, strlen(nodir));
+		execve(term.shell, args, env);
+		(void)write(STDERR_FILENO, noexec, strlen(noexec));
+		_exit(127);
+	}
+	free(env);
+
+	/* parent, the other windows' children must not hold this open */
+	tcgetattr(cur->pty, &tio);
+	tcsetattr(cur->pty, TCSAFLUSH, &tio);
+	(void)fcntl(cur->pty, F_SETFL, fcntl(cur->pty, F_GETFL) | O_NONBLOCK);
+	(void)fcntl(cur->pty, F_SETFD, FD_CLOEXEC);
+
+	tty_start(&cur->tty, cur->pty);
+}
+
+/*
+ * open a window with a shell in dir, or where we are for NULL.  all it
+ * has of its own is the X window and what draws it, the pty and term
+ */
+void
+win_new(const char *dir) {
+	struct win_s *w;
 	uint32_t values[3];
 
-	char *p;
+	if ((w = calloc(1, sizeof(*w))) == NULL)
+		err(1, "calloc");
+	w->vt = conf;
+	w->next = wins;
+	wins = w;
+	win_select(w);
+
+	values[0] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS
+		| XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE
+		| XCB_EVENT_MASK_BUTTON_1_MOTION | XCB_EVENT_MASK_STRUCTURE_NOTIFY
+		| XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+	w->win = xcb_generate_id(conn);
+	xcb_create_window (conn,
+				XCB_COPY_FROM_PARENT,
+				w->win,
+				scr->root,
+				0, 0,
+				1, 1,
+				10,
+				XCB_WINDOW_CLASS_INPUT_OUTPUT,
+				scr->root_visual,
+				XCB_CW_EVENT_MASK, values);
+
+	/* closing it asks, rather than disconnecting every window */
+	xcb_change_property(conn, XCB_PROP_MODE_REPLACE, w->win,
+			atoms[A_WM_PROTOCOLS], XCB_ATOM_ATOM, 32, 1,
+			&atoms[A_WM_DELETE_WINDOW]);
+
+	xcb_map_window(conn, w->win);
+
+	values[0] = font->ptr;
+	values[1] = 0;
+	w->gc = xcb_generate_id(conn);
+	xcb_create_gc(conn, w->gc, w->win,
+			XCB_GC_FONT | XCB_GC_GRAPHICS_EXPOSURES, values);
+
+	values[0] = term.bg;
+	values[1] = 0;
+	w->bgc = xcb_generate_id(conn);
+	xcb_create_gc(conn, w->bgc, w->win,
+			XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, values);
+
+	win_spawn(dir);
+	resize(80, 24);
+	set_bg(term.bg);
+	set_fg(term.fg);
+}
+
+/* the child has gone or the window was closed, the pty hangs up the rest */
+void
+win_close(struct win_s *w) {
+	struct win_s **p;
+
+	win_select(w);
+	tty_free(&w->tty);
+	close(w->pty);
+
+	if (w->img.px != NULL) {
+		xcb_shm_detach(conn, w->img.seg);
+		shmdt(w->img.px);
+	}
+	if (w->pic)
+		xcb_render_free_picture(conn, w->pic);
+	xcb_free_pixmap(conn, w->backbuf);
+	xcb_free_gc(conn, w->gc);
+	xcb_free_gc(conn, w->bgc);
+	xcb_destroy_window(conn, w->win);
+	term_free();
+
+	for (p = &wins; *p != w; p = &(*p)->next)
+		;
+	*p = w->next;
+	free(w);
+
+	cur = NULL;
+	termp = &conf;
+}
+
+void
+win_reap() {
+	struct win_s *w, *next;
+
+	for (w = wins; w != NULL; w = next) {
+		next = w->next;
+		if (w->vt.ttydead)
+			win_close(w);
+	}
+}
+
+/* when the next frame of the current window is due, -1 for never */
+long long
+win_deadline(long long now) {
+	if (tty_queued(&cur->tty) > 0)
+		return now;
+
+	if (!term.wants_redraw)
+		return -1;
+
+	/* woken by the completion, or to give up on it */
+	if (term.render == R_SHM && shm_busy(now))
+		return cur->img.sent + SHM_TIMEOUT;
+
+	return term.urgent ? now : term.last_frame
+		+ (term.jump ? JUMP_INTERVAL : term.frame_ms);
+}
+
+/* collect children that exited, their windows close */
+void
+reap() {
+	struct win_s *w;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+		for (w = wins; w != NULL; w = w->next)
+			if (w->vt.pid == pid)
+				w->vt.ttydead = 1;
+}
+
+/*
+ * temd, tem -d, opens a window for each tem -c that connects to its
+ * socket and names the directory to start in.  a window runs a shell as
+ * the user, so the socket sits in a directory only the user can get
+ * into, and both ends check the other runs as the same user
+ */
+int
+sock_addr(struct sockaddr_un *sa) {
+	char dir[sizeof(sa->sun_path) - sizeof("/temd")];
+	const char *run;
+	struct stat st;
+
+	if ((run = getenv("XDG_RUNTIME_DIR")) != NULL && run[0])
+		snprintf(dir, sizeof(dir), "%s", run);
+	else {
+		snprintf(dir, sizeof(dir), "/tmp/temd-%u", (unsigned)getuid());
+		(void)mkdir(dir, 0700);
+	}
+
+	/* one made by someone else first, or open to others, is not used */
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode)
+			|| st.st_uid != getuid() || st.st_mode & 077) {
+		warnx("%s is not a private directory", dir);
+		return -1;
+	}
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	snprintf(sa->sun_path, sizeof(sa->sun_path), "%s/temd", dir);
+	return 0;
+}
+
+/* the other end of fd runs as us */
+int
+sock_trusted(int fd) {
+#if defined(__linux__)
+	struct ucred cr;
+	socklen_t len = sizeof(cr);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) < 0)
+		return 0;
+	return cr.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+	if (getpeereid(fd, &uid, &gid) < 0)
+		return 0;
+	return uid == getuid();
+#endif
+}
+
+int
+sock_connect() {
+	struct sockaddr_un sa;
+	int fd;
+
+	if (sock_addr(&sa) < 0)
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+			|| !sock_trusted(fd)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+sock_listen() {
+	struct sockaddr_un sa;
+	int fd;
+
+	if (sock_addr(&sa) < 0)
+		exit(1);
+	if ((fd = sock_connect()) >= 0)
+		errx(1, "temd is already running");
+
+	/* what one that died left behind */
+	(void)unlink(sa.sun_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	(void)fcntl(fd, F_SETFL, O_NONBLOCK);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+			|| chmod(sa.sun_path, 0600) < 0 || listen(fd, 16) < 0)
+		err(1, "%s", sa.sun_path);
+
+	return fd;
+}
+
+/* tem -c: have temd open the window here, 0 when none is running */
+int
+sock_request() {
+	char dir[PATH_MAX];
+	int fd;
+
+	if ((fd = sock_connect()) < 0)
+		return 0;
+
+	if (getcwd(dir, sizeof(dir)) == NULL)
+		dir[0] = '\0';
+	(void)write(fd, dir, strlen(dir) + 1);
+	close(fd);
+
+	return 1;
+}
+
+/*
+ * take clients while there are free slots, what they send comes in over
+ * the main loop's poll() so a slow one holds up no window
+ */
+void
+sock_accept(int lfd) {
+	struct client_s *c;
+	int fd;
+
+	for (c = clients; ; c++) {
+		for (; c < clients + SOCK_CLIENTS && c->fd >= 0; c++)
+			;
+		if (c == clients + SOCK_CLIENTS || (fd = accept(lfd, NULL, NULL)) < 0)
+			return;
+
+		if (!sock_trusted(fd)) {
+			close(fd);
+			c--;
+			continue;
+		}
+
+		(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+		(void)fcntl(fd, F_SETFL, O_NONBLOCK);
+		c->fd = fd;
+		c->len = 0;
+		c->deadline = msnow() + SOCK_WAIT;
+	}
+}
+
+/* open the client's window, in our directory when it named none */
+void
+sock_done(struct client_s *c) {
+	close(c->fd);
+	c->fd = -1;
+
+	c->dir[c->len] = '\0';
+	win_new(c->dir);
+}
+
+/* the directory ends with a NUL, or when the client hangs up */
+void
+sock_read(struct client_s *c) {
+	ssize_t n;
+
+	n = read(c->fd, c->dir + c->len, sizeof(c->dir) - 1 - c->len);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (n > 0) {
+		c->len += n;
+		if (memchr(c->dir + c->len - n, '\0', n) == NULL
+				&& c->len < sizeof(c->dir) - 1)
+			return;
+	} else if (n < 0)
+		c->len = 0;
+
+	sock_done(c);
+}
+
+#if defined(__linux__)
+/* SIGCHLD is read from a signalfd and deadlines come from a timerfd */
+static long long armed = -1;
+
+int
+sig_open() {
+	sigset_t set;
+	int fd;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+
+	if ((fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		err(1, "signalfd");
+	return fd;
+}
+
+void
+sig_child(int fd) {
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si))
+		;
+
+	reap();
+}
+
+int
+timer_open() {
+	int fd;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		err(1, "timerfd_create");
+	return fd;
+}
+
+/* fire at msnow() == ms */
+void
+timer_set(int fd, long long ms) {
+	struct itimerspec it;
+
+	if (ms == armed)
+		return;
+	armed = ms;
+
+	memset(&it, 0, sizeof(it));
+	it.it_value.tv_sec = ms / 1000;
+	it.it_value.tv_nsec = ms % 1000 * 1000000;
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &it, NULL) < 0)
+		err(1, "timerfd_settime");
+}
+
+void
+timer_ack(int fd) {
+	uint64_t n;
+
+	(void)read(fd, &n, sizeof(n));
+	armed = -1;
+}
+#else
+/* a self-pipe for SIGCHLD, deadlines are poll() timeouts */
+static int sigpipe[2];
+
+static void
+sigchld(int sig) {
+	int e = errno;
+
+	(void)write(sigpipe[1], "", 1);
+	errno = e;
+}
+
+int
+sig_open() {
+	if (pipe(sigpipe) < 0)
+		err(1, "pipe");
+	(void)fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+	(void)fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+	signal(SIGCHLD, sigchld);
+
+	return sigpipe[0];
+}
+
+void
+sig_child(int fd) {
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	reap();
+}
+
+int
+timer_open() {
+	return -1;
+}
+
+void
+timer_set(int fd, long long ms) {
+}
+
+void
+timer_ack(int fd) {
+}
+#endif
+
+void
+usage() {
+	errx(1, "usage: tem [-d | -c] [-f font] [-r core|xrender|shm]");
+}
+
+int
+main(int argc, char **argv) {
+	struct pollfd *fds, *p;
+	struct client_s *c;
+	struct win_s *w;
+	long long now, deadline, t;
+	int nfds, timeout, server, client, drew, lfd, i, n;
+
 	char *argv0;
 
-	/* defaults */
+	/* defaults, every window starts out with conf */
+	termp = &conf;
 	term.bg = term.default_bg = 0x000000;
 	term.fg = term.default_fg = 0xFFFFFF;
 	term.padding = 3;
 	term.cursor_char = 0x2d4a;
 	term.wants_redraw = 1;
-	strncpy(term.fontline, "-*-gohufont-medium-*-*-*-11-*-*-*-*-*-*-1", BUFSIZ);
-	term.fi = term.bi = 0;
+	strncpy(fontline, "-*-gohufont-medium-*-*-*-11-*-*-*-*-*-*-1", BUFSIZ - 1);
 	term.cursor_vis = 1;
 	term.ttydead = 0;
+	term.hist.max = HISTLINES;
+	term.frame_ms = FRAME_INTERVAL;
+	term.render = R_XRENDER;
+	server = client = 0;
 
 	(void)setlocale(LC_ALL, "");
 
@@ -903,128 +2438,164 @@ main(int argc, char **argv) {
 	scr = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
 
 	load_config();
-	mask = XCB_CW_EVENT_MASK;
-	values[0] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS
-		| XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
-
-	win = xcb_generate_id(conn);
-	xcb_create_window (conn,
-				XCB_COPY_FROM_PARENT,
-				win,
-				scr->root,
-				0, 0,
-				1, 1,
-				10,
-				XCB_WINDOW_CLASS_INPUT_OUTPUT,
-				scr->root_visual,
-				mask, values);
-
-	xcb_map_window(conn, win);
-
-	mask = XCB_GC_GRAPHICS_EXPOSURES;
-	values[0] = 0;
-	gc = xcb_generate_id(conn);
-	xcb_create_gc(conn, gc, win, mask, values);
 
 	ARGBEGIN {
 	case 'f':
-		strncpy(term.fontline, ARGF(), BUFSIZ);
+		strncpy(fontline, EARGF(usage()), BUFSIZ - 1);
+		break;
+	case 'r':
+		term.render = render_byname(EARGF(usage()));
 		break;
+	case 'd':
+		server = 1;
+		break;
+	case 'c':
+		client = 1;
+		break;
+	default:
+		usage();
 	} ARGEND
 
-	font = load_font(gc, term.fontline);
-	resize(80, 24);
-	set_bg(term.bg);
-	set_fg(term.fg);
+	/* a running temd opens the window instead, else we do */
+	if (client && sock_request())
+		return 0;
+
+	keysyms = xcb_key_symbols_alloc(conn);
+	if (keysyms == NULL)
+		errx(1, "xcb_key_symbols_alloc");
+	keytab_init();
+	atoms_init();
+
+	/* selections longer than one request takes go INCR */
+	sel_chunk = xcb_get_maximum_request_length(conn) * 4 - 32;
+	if (sel_chunk > SEL_CHUNK)
+		sel_chunk = SEL_CHUNK;
+
+	font = load_font(fontline);
+	if (term.render == R_XRENDER)
+		xr_init();
+	else if (term.render == R_SHM)
+		shm_init();
 
-	xcb_flush(conn);
 	atexit(cleanup);
 
-	xcb_generic_event_t *ev;
-	int s;
-	ssize_t n;
-	char buf[BUFSIZ];
+	/* SIGCHLD is read from fds[FD_SIG], children get it back */
+	nfds = NFDS;
+	if ((fds = calloc(nfds, sizeof(*fds))) == NULL)
+		err(1, "calloc");
+	fds[FD_X].fd = xcb_get_file_descriptor(conn);
+	fds[FD_SIG].fd = sig_open();
+	fds[FD_TIMER].fd = timer_open();
+	lfd = server ? sock_listen() : -1;
+	for (n = 0; n < NFDS; n++)
+		fds[n].events = POLLIN;
+	for (c = clients; c < clients + SOCK_CLIENTS; c++)
+		c->fd = -1;
+
+	if (!server)
+		win_new(NULL);
+
+	for (;;) {
+		if (x_events() < 0)
+			break;
 
-	/* poll */
-	struct pollfd fds[1];
-	struct termios tio;
+		win_reap();
+		if (wins == NULL && !server)
+			break;
 
-	term.pid = forkpty(&d, NULL, NULL, NULL);
-	if (term.pid < 0)
-		err(1, "forkpty");
+		now = msnow();
+		deadline = -1;
 
-	signal(SIGCHLD, cleanup);
+		/* a client that never names its directory gets ours */
+		for (c = clients; c < clients + SOCK_CLIENTS; c++) {
+			if (c->fd >= 0 && c->deadline <= now)
+				sock_done(c);
+			else if (c->fd >= 0 && (deadline < 0 || c->deadline < deadline))
+				deadline = c->deadline;
+		}
 
-	if (term.pid == 0) {
-		/* child */
-		char *args[] = { "sh", NULL };
-		term.shell = getenv("SHELL");
-		(void)setenv("TERM", "tem-256color", 1);
-		execvp(term.shell == NULL ? SHELL : term.shell, args);
-		cleanup();
-		exit(0);
-	} else {
-		/* parent */
-		fds[0].fd = d;
-		fds[0].events = POLLIN | POLLPRI;
-
-		tcgetattr(d, &tio);
-		tcsetattr(d, TCSAFLUSH, &tio);
-	}
+		for (w = wins, drew = 0; w != NULL; w = w->next) {
+			win_select(w);
+			if (frame_due(now)) {
+				redraw();
+				term.last_frame = now;
+				term.urgent = 0;
+				drew = 1;
+			} else if ((t = win_deadline(now)) >= 0
+					&& (deadline < 0 || t < deadline))
+				deadline = t;
+		}
+
+		/* waiting on replies may have queued events */
+		if (drew)
+			continue;
 
-	while (!term.ttydead) {
-		pid_t pid;
+		/*
+		 * sleep until the X server, a reader thread, a child or a
+		 * client has something, or the next frame is due; with
+		 * nothing to draw that is indefinitely
+		 */
+		timeout = deadline < 0 ? -1 : deadline > now ? deadline - now : 0;
+		if (timeout > 0 && fds[FD_TIMER].fd >= 0) {
+			timer_set(fds[FD_TIMER].fd, deadline);
+			timeout = -1;
+		}
 
-		ev = xcb_poll_for_event(conn);
-		if (ev == NULL) {
-			if (xcb_connection_has_error(conn))
-				break;
-			else {
-				s = poll(fds, 1, POLLTIMEOUT);
-				if (s < 0)
-					err(1, "poll");
-
-				if (s && fds[0].revents & POLLIN) {
-					memset(buf, 0, BUFSIZ);
-					n = read(d, &buf, BUFSIZ);
-					xcb_printf("%*s", n, buf);
-					term.wants_redraw = 1;
-				}
+		for (n = NFDS, w = wins; w != NULL; w = w->next)
+			n += WIN_FDS;
+		if (n > nfds) {
+			nfds = n;
+			if ((fds = realloc(fds, nfds * sizeof(*fds))) == NULL)
+				err(1, "realloc");
+		}
 
-				if (term.wants_redraw)
-					redraw(n == 1 ? term.cursor.y : 0);
-			}
-		} else {
-			switch (ev->response_type & ~0x80) {
-			case XCB_EXPOSE: {
-				/* setup stuff */
-				term.wants_redraw = 1;
-			} break;
-			case XCB_KEY_PRESS: {
-				xcb_key_press_event_t *e = (xcb_key_press_event_t *)ev;
-				keypress(e->detail, e->state);
-				term.wants_redraw = 1;
-			} break;
-			case XCB_BUTTON_PRESS: {
-				xcb_button_press_event_t *e = (xcb_button_press_event_t *)ev;
-				buttonpress(e->root_x, e->root_y);
-			} break;
-			case XCB_CONFIGURE_NOTIFY: {
-				xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *)ev;
-
-				if (term.winsiz.x != e->width || term.winsiz.y != e->height)
-					if (e->width > 3 * font->width && e->height > 3 * term.height)
-						resize(e->width / font->width, e->height / font->height);
-			}	break;
-			default:
-				DEBUG("unknown event %d", ev->response_type & ~0x80);
+		/* new clients wait in the backlog while every slot is taken */
+		fds[FD_SOCK].fd = -1;
+		for (i = 0; i < SOCK_CLIENTS; i++)
+			if ((fds[FD_CLIENT + i].fd = clients[i].fd) < 0)
+				fds[FD_SOCK].fd = lfd;
+
+		/* a pty is only watched for room while input is queued */
+		for (p = fds + NFDS, w = wins; w != NULL; w = w->next, p += WIN_FDS) {
+			p[FD_TTY].fd = w->tty.ready[0];
+			p[FD_TTY].events = POLLIN;
+			p[FD_PTY].fd = w->tty.outlen ? w->pty : -1;
+			p[FD_PTY].events = POLLOUT;
+		}
+
+		xcb_flush(conn);
+		if (poll(fds, n, timeout) < 0 && errno != EINTR)
+			err(1, "poll");
+
+		if (fds[FD_TIMER].revents & POLLIN)
+			timer_ack(fds[FD_TIMER].fd);
+		if (fds[FD_SIG].revents & POLLIN)
+			sig_child(fds[FD_SIG].fd);
+
+		for (p = fds + NFDS, w = wins; w != NULL; w = w->next, p += WIN_FDS) {
+			win_select(w);
+			if (p[FD_PTY].revents & POLLOUT) {
+				tty_flush(&w->tty);
+				paste_resume();
 			}
+			if (p[FD_TTY].revents & POLLIN)
+				tty_ack(&w->tty);
+
+			pty_drain();
 		}
+
+		for (i = 0; i < SOCK_CLIENTS; i++)
+			if (fds[FD_CLIENT + i].fd >= 0 && fds[FD_CLIENT + i].revents)
+				sock_read(&clients[i]);
+		if (fds[FD_SOCK].fd >= 0 && fds[FD_SOCK].revents & POLLIN)
+			sock_accept(lfd);
 	}
 
 	DEBUG("out of the loop");
+	while (wins != NULL)
+		win_close(wins);
+	xcb_key_symbols_free(keysyms);
 	xcb_disconnect(conn);
-	free(term.map);
 	free(font);
 
 	return 0;
@@ -1,28 +1,138 @@
-#define POLLTIMEOUT 50
+#define FRAME_INTERVAL 16	/* default for xt.frameInterval, in ms */
+#define PARSE_BUDGET 8		/* ms of parsing before events are looked at */
+#define JUMP_BACKLOG (1 << 16)	/* queued pty bytes that start jump scrolling */
+#define JUMP_INTERVAL 250	/* ms between frames while jump scrolling */
+#define SHM_TIMEOUT 1000	/* ms before a put never completed is given up */
+#define HIST_WHEEL 3		/* lines per mouse wheel step */
+#define TEXT_ITEM_MAX 254	/* glyphs per PolyText16 item */
+#define TEXT_ITEMS 128		/* items per PolyText16 request */
+#define GLYPH_BATCH 128		/* glyphs uploaded per GetImage */
+#define PENS 64			/* cached solid fill pictures */
+#define BG_FILLS 16		/* background colors queued per frame */
+#define BG_RECTS 512		/* spans per PolyFillRectangle */
+#define PASTE_CHUNK (1 << 16)	/* bytes of selection fetched per GetProperty */
+#define PASTE_HIGH (1 << 20)	/* queued input that holds up an INCR paste */
+#define SEL_CHUNK (1 << 18)	/* most bytes of an owned selection per request */
+#define SEL_XFERS 8		/* INCR transfers to requestors at a time */
+#define CLICK_MS 300		/* presses this close select words, then lines */
+#define SOCK_WAIT 1000		/* ms a temd client has to name its directory */
+#define SOCK_CLIENTS 8		/* temd clients heard at a time */
 #define SHELL "/bin/sh"
 
+/* top left pixel of a cell, and where its glyph sits */
+#define CELL_X(x)	(term.padding + (x) * font->width)
+#define CELL_Y(y)	(term.padding + (y) * font->height)
+#define BASELINE(y)	(CELL_Y(y) + font->height - font->descent)
 
-#define FOREACH_CELL(X)	for (X = 0; X < term.width * term.height; X++)
-#define DEBUG(...)	warnx(__VA_ARGS__)
+#define GLYPH_SET(b, c)		((b)[(c) >> 3] |= 1 << ((c) & 7))
+#define GLYPH_ISSET(b, c)	((b)[(c) >> 3] & 1 << ((c) & 7))
 
-struct xt_cursor {
+/* core font requests take CHAR2B, a byte swapped codepoint */
+#define SWAP16(c)	((uint16_t)((c) >> 8 | (c) << 8))
+
+/* the glyph drawn for codepoint c, core fonts end at U+FFFF */
+#define GLYPH(c)	((c) > 0xffff ? 0xfffd : (c))
+
+/* styles whose cells get the same underline, strike and overline */
+#define LINES (UNDERLINE | UL_STYLE | STRUCK | OVERLINE)
+#define SAME_LINES(a, b)	(((a).attr & LINES) == ((b).attr & LINES) && (a).ul == (b).ul)
+
+/* what the main loop polls, then WIN_FDS for each window */
+enum {
+	FD_X,
+	FD_SIG,
+	FD_TIMER,
+	FD_SOCK,
+	FD_CLIENT,			/* SOCK_CLIENTS of them */
+	NFDS = FD_CLIENT + SOCK_CLIENTS
+};
+
+enum {
+	FD_TTY,
+	FD_PTY,
+	WIN_FDS
+};
+
+/* atoms interned at startup */
+enum {
+	A_UTF8_STRING,
+	A_INCR,
+	A_CLIPBOARD,
+	A_TARGETS,
+	A_TEM_PASTE,
+	A_WM_PROTOCOLS,
+	A_WM_DELETE_WINDOW,
+	NATOMS
+};
+
+static const char *atom_names[NATOMS] = {
+	[A_UTF8_STRING] = "UTF8_STRING",
+	[A_INCR] = "INCR",
+	[A_CLIPBOARD] = "CLIPBOARD",
+	[A_TARGETS] = "TARGETS",
+	[A_TEM_PASTE] = "TEM_PASTE",	/* where selections are delivered */
+	[A_WM_PROTOCOLS] = "WM_PROTOCOLS",
+	[A_WM_DELETE_WINDOW] = "WM_DELETE_WINDOW"
+};
+
+/* a selection on its way to the pty */
+struct paste_s {
+	char incr;		/* it comes in INCR pieces */
+	char held;		/* the next piece waits for the pty to drain */
+	char bracketed;		/* framed when it started */
+};
+
+/*
+ * a selection we own on its way to a requestor, INCR: each time it
+ * deletes the property the next piece goes there, an empty one ends it
+ */
+struct xfer {
+	xcb_window_t win;
+	xcb_atom_t prop, type;
+	char *text;		/* NULL while the slot is free */
+	size_t len, off;
+};
+
+/* a tem -c that connected to temd, naming its directory */
+struct client_s {
+	int fd;			/* -1 while the slot is free */
+	char dir[PATH_MAX];
+	size_t len;
+	long long deadline;	/* when it gets our directory instead */
+};
+
+/* presses of button 1, to count double and triple clicks */
+struct click_s {
+	xcb_timestamp_t time;
 	int x, y;
+	int n;
 };
 
+/* renderers */
 enum {
-	UP    = 'A',
-	DOWN  = 'B',
-	RIGHT = 'C',
-	LEFT  = 'D'
+	R_CORE,
+	R_XRENDER,
+	R_SHM
 };
 
+/* modifier bits, xterm sends 1 + these as the key's second parameter */
 enum {
-	BOLD = 1 << 1
+	KEY_SHIFT = 1 << 0,
+	KEY_ALT   = 1 << 1,
+	KEY_CTRL  = 1 << 2
+};
+
+/* bytes a key sends to the pty */
+struct keyseq {
+	uint8_t len;
+	char s[15];
 };
 
-struct tattr {
-	uint16_t ch;
-	int8_t fg, bg, attr;
+/* one TEXTELT16 of a PolyText16 request */
+struct text_item16 {
+	int8_t delta;
+	uint8_t len;
+	const uint16_t *str;
 };
 
 struct font_s {
@@ -31,297 +141,422 @@ struct font_s {
 	uint16_t char_max;
 	uint16_t char_min;
 	xcb_charinfo_t *width_lut;
+	xcb_pixmap_t strip;	/* see glyph_init() */
+	xcb_gcontext_t sgc;
 };
 
-typedef struct term_s {
+struct pen {
+	uint32_t pixel;
+	xcb_render_picture_t pic;
+};
+
+struct xrender_s {
+	xcb_render_pictformat_t format;	/* of the root visual */
+	xcb_render_glyphset_t glyphs;
+	uint8_t loaded[65536 / 8];	/* glyphs already in the glyphset */
+	struct pen pens[PENS];
+};
+
+/* cell backgrounds of one color, filled with one request */
+struct bgfill {
+	uint32_t pixel;
+	int n;
+	xcb_rectangle_t rect[BG_RECTS];
+};
+
+struct shm_s {
+	uint8_t event;			/* first event of the extension */
+	uint8_t *atlas[256];		/* glyph alpha maps, per 256 codepoints */
+	uint8_t loaded[65536 / 8];
+};
+
+/* the image a window is rasterized into by the mit-shm backend */
+struct shm_img {
+	xcb_shm_seg_t seg;
+	int id;
+	uint32_t *px;			/* width by height 0x00rrggbb pixels */
 	int width, height;
-	int fg, bg;
-	int default_fg, default_bg;
-	struct xt_cursor cursor;
-	struct xt_cursor winsiz;
-	struct tattr *map;
-	int padding;
-	uint16_t cursor_char;
-	char fontline[BUFSIZ];
-	struct xt_cursor redraw_pos;
-	char wants_redraw, esc;
-	char *esc_str;
-	uint8_t fi, bi, attr;
-	char *shell;
-	char cursor_vis;
-	char ttydead;
-	pid_t pid;
-} term_t;
-
-uint32_t colors[255] = {
+	int busy;			/* puts the server has not completed */
+	long long sent;			/* when the last of them went out */
+};
+
+/*
+ * a terminal window.  the X connection, font, glyph caches, key tables
+ * and configuration are shared by all windows of the process
+ */
+struct win_s {
+	term_t vt;			/* what term is while w is selected */
+	xcb_window_t win;
+	xcb_pixmap_t backbuf;
+	xcb_gcontext_t gc, bgc;
+	xcb_render_picture_t pic;	/* backbuf, for the xrender backend */
+	struct shm_img img;
+	int pty;			/* master side */
+	struct tty_s tty;
+	struct paste_s paste;
+	struct click_s click;
+	struct win_s *next;
+};
+
+/* keys sent as CSI final, or CSI code ~, per tem.tic */
+static const struct {
+	xcb_keysym_t sym;
+	int code;
+	char final;
+} fkeys[] = {
+	{ XK_Up,     1, 'A' },
+	{ XK_Down,   1, 'B' },
+	{ XK_Right,  1, 'C' },
+	{ XK_Left,   1, 'D' },
+	{ XK_Find,   1, '~' },
+	{ XK_Insert, 2, '~' },
+	{ XK_Delete, 3, '~' },
+	{ XK_Select, 4, '~' },
+	{ XK_Prior,  5, '~' },
+	{ XK_Next,   6, '~' },
+	{ XK_Home,   7, '~' },
+	{ XK_End,    8, '~' },
+	{ XK_F1,    11, '~' },
+	{ XK_F2,    12, '~' },
+	{ XK_F3,    13, '~' },
+	{ XK_F4,    14, '~' },
+	{ XK_F5,    15, '~' },
+	{ XK_F6,    17, '~' },
+	{ XK_F7,    18, '~' },
+	{ XK_F8,    19, '~' },
+	{ XK_F9,    20, '~' },
+	{ XK_F10,   21, '~' },
+	{ XK_F11,   23, '~' },
+	{ XK_F12,   24, '~' },
+};
+
+/* keypad keys send what the keys they stand for do, DECKPAM is not done */
+static const struct {
+	xcb_keysym_t sym, as;
+} kpkeys[] = {
+	{ XK_KP_Space,     XK_space    },
+	{ XK_KP_Tab,       XK_Tab      },
+	{ XK_KP_F1,        XK_F1       },
+	{ XK_KP_F2,        XK_F2       },
+	{ XK_KP_F3,        XK_F3       },
+	{ XK_KP_F4,        XK_F4       },
+	{ XK_KP_Home,      XK_Home     },
+	{ XK_KP_Left,      XK_Left     },
+	{ XK_KP_Up,        XK_Up       },
+	{ XK_KP_Right,     XK_Right    },
+	{ XK_KP_Down,      XK_Down     },
+	{ XK_KP_Prior,     XK_Prior    },
+	{ XK_KP_Next,      XK_Next     },
+	{ XK_KP_End,       XK_End      },
+	{ XK_KP_Insert,    XK_Insert   },
+	{ XK_KP_Delete,    XK_Delete   },
+	{ XK_KP_Equal,     XK_equal    },
+	{ XK_KP_Multiply,  XK_asterisk },
+	{ XK_KP_Add,       XK_plus     },
+	{ XK_KP_Separator, XK_comma    },
+	{ XK_KP_Subtract,  XK_minus    },
+	{ XK_KP_Decimal,   XK_period   },
+	{ XK_KP_Divide,    XK_slash    },
+	{ XK_KP_0,         XK_0        },
+	{ XK_KP_1,         XK_1        },
+	{ XK_KP_2,         XK_2        },
+	{ XK_KP_3,         XK_3        },
+	{ XK_KP_4,         XK_4        },
+	{ XK_KP_5,         XK_5        },
+	{ XK_KP_6,         XK_6        },
+	{ XK_KP_7,         XK_7        },
+	{ XK_KP_8,         XK_8        },
+	{ XK_KP_9,         XK_9        },
+};
+
+/* keys sent as a single control character, alt prefixes ESC */
+static const struct {
+	xcb_keysym_t sym;
+	char c, ctrl;
+} ckeys[] = {
+	{ XK_BackSpace, 0177, '\b' },
+	{ XK_Tab,       '\t', 0    },
+	{ XK_Return,    '\r', 0    },
+	{ XK_KP_Enter,  '\r', 0    },
+	{ XK_Escape,    033,  0    },
+};
+
+uint32_t colors[256] = {
 	/* http://www.calmar.ws/vim/256-xterm-24bit-rgb-color-chart.html */
 
 	/* base 16 */
-	[ 0] = 0x800000,
-	[ 1] = 0x008000,
-	[ 2] = 0x808000,
-	[ 3] = 0x000080,
-	[ 4] = 0x800080,
-	[ 5] = 0x008080,
-	[ 6] = 0xc0c0c0,
-	[ 7] = 0x808080,
-	[ 8] = 0xff0000,
-	[9] = 0x00ff00,
-	[10] = 0xffff00,
-	[11] = 0x0000ff,
-	[12] = 0xff00ff,
-	[13] = 0x00ffff,
-	[14] = 0xffffff,
+	[ 0] = 0x000000,
+	[ 1] = 0x800000,
+	[ 2] = 0x008000,
+	[ 3] = 0x808000,
+	[ 4] = 0x000080,
+	[ 5] = 0x800080,
+	[ 6] = 0x008080,
+	[ 7] = 0xc0c0c0,
+	[ 8] = 0x808080,
+	[ 9] = 0xff0000,
+	[10] = 0x00ff00,
+	[11] = 0xffff00,
+	[12] = 0x0000ff,
+	[13] = 0xff00ff,
+	[14] = 0x00ffff,
+	[15] = 0xffffff,
 
 	/* 116 mod */
-	[ 15] = 0x000000,
-	[ 16] = 0x00005f,
-	[ 17] = 0x000087,
-	[ 18] = 0x0000af,
-	[ 19] = 0x0000d7,
-	[ 20] = 0x0000ff,
-	[ 21] = 0x005f00,
-	[ 22] = 0x005f5f,
-	[ 23] = 0x005f87,
-	[ 24] = 0x005faf,
-	[ 25] = 0x005fd7,
-	[ 26] = 0x005fff,
-	[ 27] = 0x008700,
-	[ 28] = 0x00875f,
-	[ 29] = 0x008787,
-	[ 30] = 0x0087af,
-	[ 31] = 0x0087d7,
-	[ 32] = 0x0087ff,
-	[ 33] = 0x00af00,
-	[ 34] = 0x00af5f,
-	[ 35] = 0x00af87,
-	[ 36] = 0x00afaf,
-	[ 37] = 0x00afd7,
-	[ 38] = 0x00afff,
-	[ 39] = 0x00d700,
-	[ 40] = 0x00d75f,
-	[ 41] = 0x00d787,
-	[ 42] = 0x00d7af,
-	[ 43] = 0x00d7d7,
-	[ 44] = 0x00d7ff,
-	[ 45] = 0x00ff00,
-	[ 46] = 0x00ff5f,
-	[ 47] = 0x00ff87,
-	[ 48] = 0x00ffaf,
-	[ 49] = 0x00ffd7,
-	[ 50] = 0x00ffff,
-	[ 51] = 0x5f0000,
-	[ 52] = 0x5f005f,
-	[ 53] = 0x5f0087,
-	[ 54] = 0x5f00af,
-	[ 55] = 0x5f00d7,
-	[ 56] = 0x5f00ff,
-	[ 57] = 0x5f5f00,
-	[ 58] = 0x5f5f5f,
-	[ 59] = 0x5f5f87,
-	[ 60] = 0x5f5faf,
-	[ 61] = 0x5f5fd7,
-	[ 62] = 0x5f5fff,
-	[ 63] = 0x5f8700,
-	[ 64] = 0x5f875f,
-	[ 65] = 0x5f8787,
-	[ 66] = 0x5f87af,
-	[ 67] = 0x5f87d7,
-	[ 68] = 0x5f87ff,
-	[ 69] = 0x5faf00,
-	[ 70] = 0x5faf5f,
-	[ 71] = 0x5faf87,
-	[ 72] = 0x5fafaf,
-	[ 73] = 0x5fafd7,
-	[ 74] = 0x5fafff,
-	[ 75] = 0x5fd700,
-	[ 76] = 0x5fd75f,
-	[ 77] = 0x5fd787,
-	[ 78] = 0x5fd7af,
-	[ 79] = 0x5fd7d7,
-	[ 80] = 0x5fd7ff,
-	[ 81] = 0x5fff00,
-	[ 82] = 0x5fff5f,
-	[ 83] = 0x5fff87,
-	[ 84] = 0x5fffaf,
-	[ 85] = 0x5fffd7,
-	[ 86] = 0x5fffff,
-	[ 87] = 0x870000,
-	[ 88] = 0x87005f,
-	[ 89] = 0x870087,
-	[ 90] = 0x8700af,
-	[ 91] = 0x8700d7,
-	[ 92] = 0x8700ff,
-	[ 93] = 0x875f00,
-	[ 94] = 0x875f5f,
-	[ 95] = 0x875f87,
-	[ 96] = 0x875faf,
-	[ 97] = 0x875fd7,
-	[ 98] = 0x875fff,
-	[99] = 0x878700,
-	[100] = 0x87875f,
-	[101] = 0x878787,
-	[102] = 0x8787af,
-	[103] = 0x8787d7,
-	[104] = 0x8787ff,
-	[105] = 0x87af00,
-	[106] = 0x87af5f,
-	[107] = 0x87af87,
-	[108] = 0x87afaf,
-	[109] = 0x87afd7,
-	[110] = 0x87afff,
-	[111] = 0x87d700,
-	[112] = 0x87d75f,
-	[113] = 0x87d787,
-	[114] = 0x87d7af,
-	[115] = 0x87d7d7,
-	[116] = 0x87d7ff,
-	[117] = 0x87ff00,
-	[118] = 0x87ff5f,
-	[119] = 0x87ff87,
-	[120] = 0x87ffaf,
-	[121] = 0x87ffd7,
-	[122] = 0x87ffff,
-	[123] = 0xaf0000,
-	[124] = 0xaf005f,
-	[125] = 0xaf0087,
-	[126] = 0xaf00af,
-	[127] = 0xaf00d7,
-	[128] = 0xaf00ff,
-	[129] = 0xaf5f00,
-	[130] = 0xaf5f5f,
-	[131] = 0xaf5f87,
-	[132] = 0xaf5faf,
-	[133] = 0xaf5fd7,
-	[134] = 0xaf5fff,
-	[135] = 0xaf8700,
-	[136] = 0xaf875f,
-	[137] = 0xaf8787,
-	[138] = 0xaf87af,
-	[139] = 0xaf87d7,
-	[140] = 0xaf87ff,
-	[141] = 0xafaf00,
-	[142] = 0xafaf5f,
-	[143] = 0xafaf87,
-	[144] = 0xafafaf,
-	[145] = 0xafafd7,
-	[146] = 0xafafff,
-	[147] = 0xafd700,
-	[148] = 0xafd75f,
-	[149] = 0xafd787,
-	[150] = 0xafd7af,
-	[151] = 0xafd7d7,
-	[152] = 0xafd7ff,
-	[153] = 0xafff00,
-	[154] = 0xafff5f,
-	[155] = 0xafff87,
-	[156] = 0xafffaf,
-	[157] = 0xafffd7,
-	[158] = 0xafffff,
-	[159] = 0xd70000,
-	[160] = 0xd7005f,
-	[161] = 0xd70087,
-	[162] = 0xd700af,
-	[163] = 0xd700d7,
-	[164] = 0xd700ff,
-	[165] = 0xd75f00,
-	[166] = 0xd75f5f,
-	[167] = 0xd75f87,
-	[168] = 0xd75faf,
-	[169] = 0xd75fd7,
-	[170] = 0xd75fff,
-	[171] = 0xd78700,
-	[172] = 0xd7875f,
-	[173] = 0xd78787,
-	[174] = 0xd787af,
-	[175] = 0xd787d7,
-	[176] = 0xd787ff,
-	[177] = 0xd7af00,
-	[178] = 0xd7af5f,
-	[179] = 0xd7af87,
-	[180] = 0xd7afaf,
-	[181] = 0xd7afd7,
-	[182] = 0xd7afff,
-	[183] = 0xd7d700,
-	[184] = 0xd7d75f,
-	[185] = 0xd7d787,
-	[186] = 0xd7d7af,
-	[187] = 0xd7d7d7,
-	[188] = 0xd7d7ff,
-	[189] = 0xd7ff00,
-	[190] = 0xd7ff5f,
-	[191] = 0xd7ff87,
-	[192] = 0xd7ffaf,
-	[193] = 0xd7ffd7,
-	[194] = 0xd7ffff,
-	[195] = 0xff0000,
-	[196] = 0xff005f,
-	[197] = 0xff0087,
-	[198] = 0xff00af,
-	[199] = 0xff00d7,
-	[200] = 0xff00ff,
-	[201] = 0xff5f00,
-	[202] = 0xff5f5f,
-	[203] = 0xff5f87,
-	[204] = 0xff5faf,
-	[205] = 0xff5fd7,
-	[206] = 0xff5fff,
-	[207] = 0xff8700,
-	[208] = 0xff875f,
-	[209] = 0xff8787,
-	[210] = 0xff87af,
-	[211] = 0xff87d7,
-	[212] = 0xff87ff,
-	[213] = 0xffaf00,
-	[214] = 0xffaf5f,
-	[215] = 0xffaf87,
-	[216] = 0xffafaf,
-	[217] = 0xffafd7,
-	[218] = 0xffafff,
-	[219] = 0xffd700,
-	[220] = 0xffd75f,
-	[221] = 0xffd787,
-	[222] = 0xffd7af,
-	[223] = 0xffd7d7,
-	[224] = 0xffd7ff,
-	[225] = 0xffff00,
-	[226] = 0xffff5f,
-	[227] = 0xffff87,
-	[228] = 0xffffaf,
-	[229] = 0xffffd7,
-	[230] = 0xffffff,
+	[ 16] = 0x000000,
+	[ 17] = 0x00005f,
+	[ 18] = 0x000087,
+	[ 19] = 0x0000af,
+	[ 20] = 0x0000d7,
+	[ 21] = 0x0000ff,
+	[ 22] = 0x005f00,
+	[ 23] = 0x005f5f,
+	[ 24] = 0x005f87,
+	[ 25] = 0x005faf,
+	[ 26] = 0x005fd7,
+	[ 27] = 0x005fff,
+	[ 28] = 0x008700,
+	[ 29] = 0x00875f,
+	[ 30] = 0x008787,
+	[ 31] = 0x0087af,
+	[ 32] = 0x0087d7,
+	[ 33] = 0x0087ff,
+	[ 34] = 0x00af00,
+	[ 35] = 0x00af5f,
+	[ 36] = 0x00af87,
+	[ 37] = 0x00afaf,
+	[ 38] = 0x00afd7,
+	[ 39] = 0x00afff,
+	[ 40] = 0x00d700,
+	[ 41] = 0x00d75f,
+	[ 42] = 0x00d787,
+	[ 43] = 0x00d7af,
+	[ 44] = 0x00d7d7,
+	[ 45] = 0x00d7ff,
+	[ 46] = 0x00ff00,
+	[ 47] = 0x00ff5f,
+	[ 48] = 0x00ff87,
+	[ 49] = 0x00ffaf,
+	[ 50] = 0x00ffd7,
+	[ 51] = 0x00ffff,
+	[ 52] = 0x5f0000,
+	[ 53] = 0x5f005f,
+	[ 54] = 0x5f0087,
+	[ 55] = 0x5f00af,
+	[ 56] = 0x5f00d7,
+	[ 57] = 0x5f00ff,
+	[ 58] = 0x5f5f00,
+	[ 59] = 0x5f5f5f,
+	[ 60] = 0x5f5f87,
+	[ 61] = 0x5f5faf,
+	[ 62] = 0x5f5fd7,
+	[ 63] = 0x5f5fff,
+	[ 64] = 0x5f8700,
+	[ 65] = 0x5f875f,
+	[ 66] = 0x5f8787,
+	[ 67] = 0x5f87af,
+	[ 68] = 0x5f87d7,
+	[ 69] = 0x5f87ff,
+	[ 70] = 0x5faf00,
+	[ 71] = 0x5faf5f,
+	[ 72] = 0x5faf87,
+	[ 73] = 0x5fafaf,
+	[ 74] = 0x5fafd7,
+	[ 75] = 0x5fafff,
+	[ 76] = 0x5fd700,
+	[ 77] = 0x5fd75f,
+	[ 78] = 0x5fd787,
+	[ 79] = 0x5fd7af,
+	[ 80] = 0x5fd7d7,
+	[ 81] = 0x5fd7ff,
+	[ 82] = 0x5fff00,
+	[ 83] = 0x5fff5f,
+	[ 84] = 0x5fff87,
+	[ 85] = 0x5fffaf,
+	[ 86] = 0x5fffd7,
+	[ 87] = 0x5fffff,
+	[ 88] = 0x870000,
+	[ 89] = 0x87005f,
+	[ 90] = 0x870087,
+	[ 91] = 0x8700af,
+	[ 92] = 0x8700d7,
+	[ 93] = 0x8700ff,
+	[ 94] = 0x875f00,
+	[ 95] = 0x875f5f,
+	[ 96] = 0x875f87,
+	[ 97] = 0x875faf,
+	[ 98] = 0x875fd7,
+	[ 99] = 0x875fff,
+	[100] = 0x878700,
+	[101] = 0x87875f,
+	[102] = 0x878787,
+	[103] = 0x8787af,
+	[104] = 0x8787d7,
+	[105] = 0x8787ff,
+	[106] = 0x87af00,
+	[107] = 0x87af5f,
+	[108] = 0x87af87,
+	[109] = 0x87afaf,
+	[110] = 0x87afd7,
+	[111] = 0x87afff,
+	[112] = 0x87d700,
+	[113] = 0x87d75f,
+	[114] = 0x87d787,
+	[115] = 0x87d7af,
+	[116] = 0x87d7d7,
+	[117] = 0x87d7ff,
+	[118] = 0x87ff00,
+	[119] = 0x87ff5f,
+	[120] = 0x87ff87,
+	[121] = 0x87ffaf,
+	[122] = 0x87ffd7,
+	[123] = 0x87ffff,
+	[124] = 0xaf0000,
+	[125] = 0xaf005f,
+	[126] = 0xaf0087,
+	[127] = 0xaf00af,
+	[128] = 0xaf00d7,
+	[129] = 0xaf00ff,
+	[130] = 0xaf5f00,
+	[131] = 0xaf5f5f,
+	[132] = 0xaf5f87,
+	[133] = 0xaf5faf,
+	[134] = 0xaf5fd7,
+	[135] = 0xaf5fff,
+	[136] = 0xaf8700,
+	[137] = 0xaf875f,
+	[138] = 0xaf8787,
+	[139] = 0xaf87af,
+	[140] = 0xaf87d7,
+	[141] = 0xaf87ff,
+	[142] = 0xafaf00,
+	[143] = 0xafaf5f,
+	[144] = 0xafaf87,
+	[145] = 0xafafaf,
+	[146] = 0xafafd7,
+	[147] = 0xafafff,
+	[148] = 0xafd700,
+	[149] = 0xafd75f,
+	[150] = 0xafd787,
+	[151] = 0xafd7af,
+	[152] = 0xafd7d7,
+	[153] = 0xafd7ff,
+	[154] = 0xafff00,
+	[155] = 0xafff5f,
+	[156] = 0xafff87,
+	[157] = 0xafffaf,
+	[158] = 0xafffd7,
+	[159] = 0xafffff,
+	[160] = 0xd70000,
+	[161] = 0xd7005f,
+	[162] = 0xd70087,
+	[163] = 0xd700af,
+	[164] = 0xd700d7,
+	[165] = 0xd700ff,
+	[166] = 0xd75f00,
+	[167] = 0xd75f5f,
+	[168] = 0xd75f87,
+	[169] = 0xd75faf,
+	[170] = 0xd75fd7,
+	[171] = 0xd75fff,
+	[172] = 0xd78700,
+	[173] = 0xd7875f,
+	[174] = 0xd78787,
+	[175] = 0xd787af,
+	[176] = 0xd787d7,
+	[177] = 0xd787ff,
+	[178] = 0xd7af00,
+	[179] = 0xd7af5f,
+	[180] = 0xd7af87,
+	[181] = 0xd7afaf,
+	[182] = 0xd7afd7,
+	[183] = 0xd7afff,
+	[184] = 0xd7d700,
+	[185] = 0xd7d75f,
+	[186] = 0xd7d787,
+	[187] = 0xd7d7af,
+	[188] = 0xd7d7d7,
+	[189] = 0xd7d7ff,
+	[190] = 0xd7ff00,
+	[191] = 0xd7ff5f,
+	[192] = 0xd7ff87,
+	[193] = 0xd7ffaf,
+	[194] = 0xd7ffd7,
+	[195] = 0xd7ffff,
+	[196] = 0xff0000,
+	[197] = 0xff005f,
+	[198] = 0xff0087,
+	[199] = 0xff00af,
+	[200] = 0xff00d7,
+	[201] = 0xff00ff,
+	[202] = 0xff5f00,
+	[203] = 0xff5f5f,
+	[204] = 0xff5f87,
+	[205] = 0xff5faf,
+	[206] = 0xff5fd7,
+	[207] = 0xff5fff,
+	[208] = 0xff8700,
+	[209] = 0xff875f,
+	[210] = 0xff8787,
+	[211] = 0xff87af,
+	[212] = 0xff87d7,
+	[213] = 0xff87ff,
+	[214] = 0xffaf00,
+	[215] = 0xffaf5f,
+	[216] = 0xffaf87,
+	[217] = 0xffafaf,
+	[218] = 0xffafd7,
+	[219] = 0xffafff,
+	[220] = 0xffd700,
+	[221] = 0xffd75f,
+	[222] = 0xffd787,
+	[223] = 0xffd7af,
+	[224] = 0xffd7d7,
+	[225] = 0xffd7ff,
+	[226] = 0xffff00,
+	[227] = 0xffff5f,
+	[228] = 0xffff87,
+	[229] = 0xffffaf,
+	[230] = 0xffffd7,
+	[231] = 0xffffff,
 
 	/* greyscale */
-	[231] = 0x080808,
-	[232] = 0x121212,
-	[233] = 0x1c1c1c,
-	[234] = 0x262626,
-	[235] = 0x303030,
-	[236] = 0x3a3a3a,
-	[237] = 0x444444,
-	[238] = 0x4e4e4e,
-	[239] = 0x585858,
-	[240] = 0x606060,
-	[241] = 0x666666,
-	[242] = 0x767676,
-	[243] = 0x808080,
-	[244] = 0x8a8a8a,
-	[245] = 0x949494,
-	[246] = 0x9e9e9e,
-	[247] = 0xa8a8a8,
-	[248] = 0xb2b2b2,
-	[249] = 0xbcbcbc,
-	[250] = 0xc6c6c6,
-	[251] = 0xd0d0d0,
-	[252] = 0xdadada,
-	[253] = 0xe4e4e4,
-	[254] = 0xeeeeee,
+	[232] = 0x080808,
+	[233] = 0x121212,
+	[234] = 0x1c1c1c,
+	[235] = 0x262626,
+	[236] = 0x303030,
+	[237] = 0x3a3a3a,
+	[238] = 0x444444,
+	[239] = 0x4e4e4e,
+	[240] = 0x585858,
+	[241] = 0x606060,
+	[242] = 0x666666,
+	[243] = 0x767676,
+	[244] = 0x808080,
+	[245] = 0x8a8a8a,
+	[246] = 0x949494,
+	[247] = 0x9e9e9e,
+	[248] = 0xa8a8a8,
+	[249] = 0xb2b2b2,
+	[250] = 0xbcbcbc,
+	[251] = 0xc6c6c6,
+	[252] = 0xd0d0d0,
+	[253] = 0xdadada,
+	[254] = 0xe4e4e4,
+	[255] = 0xeeeeee,
 };
 
 /* protos */
 void clrscr();
-void xcb_printf(char *, ...);
-int valid_xy(int, int);
-
-
-
+void glyph_init();
+int glyph_fetch(const uint16_t *, int, uint8_t *);
+void xr_load(const uint16_t *, int);
+void shm_load(const uint16_t *, int);
+void xr_draw_run(struct tattr *, int, int, int, uint32_t);
+void shm_draw_row(struct tattr *, int, int, int);
+void shm_fill(int, int, int, int, uint32_t);
+void shm_put();
+int shm_busy(long long);
+long long msnow();
+void bg_flush();
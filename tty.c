@@ -0,0 +1,248 @@
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <err.h>
+
+#if defined(__linux__)
+	#include <sys/eventfd.h>
+#endif
+
+#include "tty.h"
+
+/*
+ * the pty reader.  tem sleeps in poll() on ready[0] only when the ring
+ * is empty, and the reader on space[0] only when it is full, so each side
+ * publishes its index and then looks at the other's before deciding to
+ * wake it; with sequentially consistent atomics one of them always sees
+ * the other's store and no wakeup is lost.
+ */
+
+/* an eventfd where there is one, else a pipe; [0] is polled, [1] written */
+static void
+wake_init(int fd[2]) {
+#if defined(__linux__)
+	fd[0] = fd[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd[0] < 0)
+		err(1, "eventfd");
+#else
+	if (pipe(fd) < 0)
+		err(1, "pipe");
+	(void)fcntl(fd[0], F_SETFL, O_NONBLOCK);
+	(void)fcntl(fd[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+static void
+wake(int fd) {
+	uint64_t one = 1;
+
+	/* a full pipe or counter is as good as a write */
+	(void)write(fd, &one, sizeof(one));
+}
+
+static void
+wake_clear(int fd) {
+	uint64_t buf[8];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void *
+tty_reader(void *arg) {
+	struct tty_s *t = arg;
+	struct pollfd pfd;
+	size_t head, tail, room, off;
+	ssize_t n;
+
+	for (;;) {
+		head = atomic_load_explicit(&t->head, memory_order_relaxed);
+		tail = atomic_load_explicit(&t->tail, memory_order_acquire);
+
+		if ((room = TTY_RING - (head - tail)) == 0) {
+			atomic_store(&t->full, 1);
+			if (atomic_load(&t->tail) == tail) {
+				pfd.fd = t->space[0];
+				pfd.events = POLLIN;
+				(void)poll(&pfd, 1, -1);
+				wake_clear(t->space[0]);
+			}
+			atomic_store(&t->full, 0);
+			continue;
+		}
+
+		/* up to the end of the buffer, the rest goes in the next read */
+		off = head & (TTY_RING - 1);
+		if (room > TTY_RING - off)
+			room = TTY_RING - off;
+		if (room > READ_MAX)
+			room = READ_MAX;
+
+		n = read(t->fd, t->buf + off, room);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			pfd.fd = t->fd;
+			pfd.events = POLLIN;
+			(void)poll(&pfd, 1, -1);
+			continue;
+		}
+		if (n <= 0) {
+			/* EIO once the child has gone */
+			atomic_store(&t->dead, 1);
+			wake(t->ready[1]);
+			return NULL;
+		}
+
+		atomic_store(&t->head, head + n);
+		if (atomic_load(&t->tail) == head)
+			wake(t->ready[1]);
+	}
+}
+
+/* start reading pty master fd, signals stay with the main thread */
+void
+tty_start(struct tty_s *t, int fd) {
+	pthread_attr_t attr;
+	sigset_t all, old;
+
+	t->fd = fd;
+	if ((t->buf = malloc(TTY_RING)) == NULL)
+		err(1, "malloc");
+	wake_init(t->ready);
+	wake_init(t->space);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, TTY_STACK);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if ((errno = pthread_create(&t->thread, &attr, tty_reader, t)) != 0)
+		err(1, "pthread_create");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * stop the reader, which may still sit in poll() when something else
+ * holds the pty open, and free what tty_start() set up; fd stays open
+ */
+void
+tty_free(struct tty_s *t) {
+	pthread_cancel(t->thread);
+	pthread_join(t->thread, NULL);
+
+	close(t->ready[0]);
+	if (t->ready[1] != t->ready[0])
+		close(t->ready[1]);
+	close(t->space[0]);
+	if (t->space[1] != t->space[0])
+		close(t->space[1]);
+
+	free(t->buf);
+	free(t->out);
+}
+
+/* the bytes after the tail that can be read in one piece, at *p */
+size_t
+tty_peek(struct tty_s *t, const char **p) {
+	size_t head, tail, off, n;
+
+	tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&t->head, memory_order_acquire);
+
+	off = tail & (TTY_RING - 1);
+	n = head - tail;
+	if (n > TTY_RING - off)
+		n = TTY_RING - off;
+
+	*p = (const char *)t->buf + off;
+	return n;
+}
+
+/* hand n peeked bytes back to the reader */
+void
+tty_consume(struct tty_s *t, size_t n) {
+	atomic_store(&t->tail, atomic_load_explicit(&t->tail,
+				memory_order_relaxed) + n);
+
+	if (atomic_load(&t->full))
+		wake(t->space[1]);
+}
+
+/* how far the parser is behind, look at it before sleeping on ready[0] */
+size_t
+tty_queued(struct tty_s *t) {
+	return atomic_load(&t->head) - atomic_load(&t->tail);
+}
+
+/* the child has gone and all it wrote is parsed */
+int
+tty_done(struct tty_s *t) {
+	return atomic_load(&t->dead) && tty_queued(t) == 0;
+}
+
+/* call when ready[0] polls readable, before looking at the ring */
+void
+tty_ack(struct tty_s *t) {
+	wake_clear(t->ready[0]);
+}
+
+/*
+ * the input side stays on the main thread: writes that the pty does not
+ * take at once wait in a queue, which tty_flush() works off in WRITE_MAX
+ * pieces whenever poll() says the fd is writable
+ */
+void
+tty_write(struct tty_s *t, const char *s, size_t n) {
+	ssize_t w;
+
+	/* nothing to keep the order with, try the pty first */
+	if (t->outlen == 0) {
+		w = write(t->fd, s, n < WRITE_MAX ? n : WRITE_MAX);
+		if (w > 0) {
+			s += w;
+			n -= w;
+		}
+	}
+	if (n == 0)
+		return;
+
+	if (t->outoff + t->outlen + n > t->outsiz) {
+		memmove(t->out, t->out + t->outoff, t->outlen);
+		t->outoff = 0;
+
+		if (t->outlen + n > t->outsiz) {
+			t->outsiz = (t->outlen + n) * 2;
+			if ((t->out = realloc(t->out, t->outsiz)) == NULL)
+				err(1, "realloc");
+		}
+	}
+
+	memcpy(t->out + t->outoff + t->outlen, s, n);
+	t->outlen += n;
+}
+
+void
+tty_flush(struct tty_s *t) {
+	ssize_t w;
+
+	w = write(t->fd, t->out + t->outoff,
+			t->outlen < WRITE_MAX ? t->outlen : WRITE_MAX);
+
+	if (w < 0 && errno != EAGAIN && errno != EINTR)
+		w = t->outlen;	/* the child has gone, and its input with it */
+	if (w <= 0)
+		return;
+
+	t->outoff += w;
+	t->outlen -= w;
+	if (t->outlen == 0)
+		t->outoff = 0;
+}
@@ -0,0 +1,36 @@
+#define TTY_RING (256 << 10)	/* pty output buffered ahead of the parser */
+#define READ_MAX (64 << 10)	/* largest single pty read */
+#define WRITE_MAX 4096		/* largest single pty write */
+#define TTY_STACK (64 << 10)	/* the reader needs next to no stack */
+
+/*
+ * pty output is read by a thread of its own into a single producer,
+ * single consumer ring, so the child never waits on the X server.  every
+ * window has one, so it is kept small: the parser is far slower than the
+ * reader, and a ring that stays in cache outruns a larger one.  head
+ * and tail count bytes ever read and parsed, the ring index is their low
+ * bits, so TTY_RING must be a power of two
+ */
+struct tty_s {
+	int fd;			/* pty master */
+	int ready[2];		/* readable once the ring is no longer empty */
+	int space[2];		/* wakes the reader waiting on a full ring */
+	uint8_t *buf;
+	_Atomic size_t head;	/* advanced by the reader */
+	_Atomic size_t tail;	/* advanced by the parser */
+	_Atomic int full;	/* the reader sleeps on space */
+	_Atomic int dead;	/* the pty hung up, head moves no more */
+	pthread_t thread;
+	char *out;		/* input the child has not taken yet */
+	size_t outoff, outlen, outsiz;
+};
+
+void tty_start(struct tty_s *, int);
+void tty_free(struct tty_s *);
+size_t tty_peek(struct tty_s *, const char **);
+void tty_consume(struct tty_s *, size_t);
+size_t tty_queued(struct tty_s *);
+int tty_done(struct tty_s *);
+void tty_ack(struct tty_s *);
+void tty_write(struct tty_s *, const char *, size_t);
+void tty_flush(struct tty_s *);
@@ -0,0 +1,2015 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+	#define HAVE_SSE2
+	#include <immintrin.h>
+#endif
+
+#include "vt.h"
+#include "width.h"
+
+/*
+ * the terminal proper: parser, grid, scrollback and damage.  nothing here
+ * talks to X, the frontend feeds it with term_write(), paints the damaged
+ * rows through view_row() and applies term.shift in shift_flush().
+ * everything works on term, which is *termp: a frontend with several
+ * terminals points termp at the one an event is for.
+ */
+static term_t term0;
+term_t *termp = &term0;
+
+/* damage cells x0..x1 of window row y */
+void
+damage_view(int x0, int x1, int y) {
+	struct xt_span *sp;
+
+	if (y < 0 || y >= term.height)
+		return;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (x1 > term.width)
+		x1 = term.width;
+	if (x0 >= x1)
+		return;
+
+	sp = &term.damage[y];
+	if (!DIRTY_ISSET(y)) {
+		DIRTY_SET(y);
+		sp->x0 = x0;
+		sp->x1 = x1;
+	} else {
+		if (x0 < sp->x0)
+			sp->x0 = x0;
+		if (x1 > sp->x1)
+			sp->x1 = x1;
+	}
+
+	term.wants_redraw = 1;
+}
+
+/* damage cells x0..x1 of screen row y, wherever the viewport shows it */
+void
+damage(int x0, int x1, int y) {
+	damage_view(x0, x1, y + term.view);
+}
+
+void
+damage_rows(int y0, int y1) {
+	int y;
+
+	for (y = y0; y < y1; y++)
+		damage(0, term.width, y);
+}
+
+void
+damage_all() {
+	int y;
+
+	for (y = 0; y < term.height; y++)
+		damage_view(0, term.width, y);
+}
+
+/*
+ * move display rows y0 to y1 up by n, or down for negative n.  the pixels
+ * are moved at the next redraw, so only the rows that come into view have
+ * to be painted, and scrolls within one frame add up to a single copy.
+ */
+void
+scroll_view(int y0, int y1, int n) {
+	struct xt_shift *sh = &term.shift;
+	struct xt_span *sp = term.damage;
+	int y;
+
+	if (y1 > term.height)
+		y1 = term.height;
+	if (n == 0 || y0 >= y1)
+		return;
+
+	if (sh->n && (sh->y0 != y0 || sh->y1 != y1 || (sh->n > 0) != (n > 0)))
+		shift_flush();
+
+	sh->y0 = y0;
+	sh->y1 = y1;
+	sh->n += n;
+
+	/* damage moves along with the rows */
+	for (y = n > 0 ? y0 : y1 - 1; y >= y0 && y < y1; y += n > 0 ? 1 : -1) {
+		DIRTY_CLR(y);
+		if (y + n >= y0 && y + n < y1 && DIRTY_ISSET(y + n)) {
+			DIRTY_SET(y);
+			sp[y] = sp[y + n];
+		} else if (y + n < y0 || y + n >= y1)
+			damage_view(0, term.width, y);
+	}
+
+	/* and so does the cursor painted into them */
+	if (term.redraw_pos.y >= y0 && term.redraw_pos.y < y1) {
+		term.redraw_pos.y -= n;
+		if (term.redraw_pos.y < y0 || term.redraw_pos.y >= y1)
+			term.redraw_pos.y = -1;
+	}
+}
+
+/* move the cursor a cell, up and down stop at the margins */
+void
+cursormv(int dir) {
+	term.wrapnext = 0;
+
+	switch (dir) {
+	case UP:
+		if (term.cursor.y != term.margin0
+				&& valid_xy(term.cursor.x, term.cursor.y - 1))
+			term.cursor.y--;
+		break;
+	case DOWN:
+		if (term.cursor.y != term.margin1 - 1
+				&& valid_xy(term.cursor.x, term.cursor.y + 1))
+			term.cursor.y++;
+		break;
+	case RIGHT:
+		if (valid_xy(term.cursor.x + 1, term.cursor.y))
+			term.cursor.x++;
+		break;
+	case LEFT:
+		if (valid_xy(term.cursor.x - 1, term.cursor.y))
+			term.cursor.x--;
+		break;
+	}
+}
+
+/*
+ * styles
+ *
+ * every distinct combination of colors and attributes is stored once in
+ * term.styles and cells hold its index, so truecolor costs a cell no more
+ * than the palette does.  term.stylehash finds an existing entry.
+ */
+static uint32_t
+style_hash(const struct style *s) {
+	uint32_t h;
+
+	h = s->fg * 0x9e3779b1 ^ s->bg * 0x85ebca77 ^ s->ul * 0x27d4eb2f
+		^ s->attr * 0xc2b2ae3d;
+	return h ^ h >> 15;
+}
+
+/* size the hash for term.stylesiz styles and fill it again */
+void
+style_rehash() {
+	uint32_t i, mask;
+	int n;
+
+	free(term.stylehash);
+	term.stylehash = malloc(term.stylesiz * 2 * sizeof(*term.stylehash));
+	if (term.stylehash == NULL)
+		err(1, "malloc");
+
+	memset(term.stylehash, 0xff, term.stylesiz * 2 * sizeof(*term.stylehash));
+	mask = term.stylesiz * 2 - 1;
+	for (n = 0; n < term.nstyles; n++) {
+		for (i = style_hash(&term.styles[n]) & mask;
+				term.stylehash[i] != STYLE_NONE; i = (i + 1) & mask)
+			;
+		term.stylehash[i] = n;
+	}
+}
+
+void
+style_grow() {
+	term.stylesiz = term.stylesiz ? term.stylesiz * 2 : 64;
+	term.styles = realloc(term.styles, term.stylesiz * sizeof(*term.styles));
+	if (term.styles == NULL)
+		err(1, "realloc");
+
+	style_rehash();
+}
+
+/*
+ * the table is full: keep only the styles the grids, the pen and the
+ * scratch rows still use, and renumber the cells
+ */
+int
+style_collect() {
+	struct tattr *grids[] = { term.map, term.alt };
+	uint16_t *remap;
+	size_t g;
+	int i, n;
+
+	if ((remap = calloc(STYLE_MAX, sizeof(*remap))) == NULL)
+		err(1, "calloc");
+
+	/* 1 + the new index, 0 while unused */
+	remap[0] = remap[term.penid] = remap[term.blankid] = 1;
+	for (g = 0; g < LEN(grids); g++)
+		for (i = 0; i < term.rows * term.width; i++)
+			remap[grids[g][i].style] = 1;
+	for (i = 0; i < term.width; i++)
+		remap[term.hist.line[i].style] = remap[term.selrow[i].style] = 1;
+
+	for (i = n = 0; i < term.nstyles; i++)
+		if (remap[i]) {
+			term.styles[n] = term.styles[i];
+			remap[i] = ++n;
+		}
+	term.nstyles = n;
+
+	for (g = 0; g < LEN(grids); g++)
+		for (i = 0; i < term.rows * term.width; i++)
+			grids[g][i].style = remap[grids[g][i].style] - 1;
+	for (i = 0; i < term.width; i++) {
+		term.hist.line[i].style = remap[term.hist.line[i].style] - 1;
+		term.selrow[i].style = remap[term.selrow[i].style] - 1;
+	}
+	term.penid = remap[term.penid] - 1;
+	term.blankid = remap[term.blankid] - 1;
+
+	free(remap);
+	style_rehash();
+	damage_all();
+
+	return term.nstyles < STYLE_MAX;
+}
+
+/* index of style s, added on first use */
+uint16_t
+style_id(const struct style *s) {
+	uint32_t i, mask;
+	uint16_t id;
+
+	mask = term.stylesiz * 2 - 1;
+	for (i = style_hash(s) & mask; (id = term.stylehash[i]) != STYLE_NONE;
+			i = (i + 1) & mask)
+		if (SAME_STYLE(term.styles[id], *s))
+			return id;
+
+	/* both move the slot, so look again */
+	if (term.nstyles == STYLE_MAX) {
+		if (!style_collect())
+			return 0;
+		return style_id(s);
+	}
+	if (term.nstyles == term.stylesiz) {
+		style_grow();
+		return style_id(s);
+	}
+
+	term.styles[term.nstyles] = *s;
+	term.stylehash[i] = term.nstyles;
+	return term.nstyles++;
+}
+
+/* intern the pen once sgr() or a cursor restore changed it */
+void
+pen_update() {
+	struct style blank = { 0, term.pen.bg, 0, 0 };
+
+	term.penid = style_id(&term.pen);
+	term.blankid = style_id(&blank);
+}
+
+/*
+ * scrollback history
+ *
+ * lines that scroll off the top are encoded as attribute runs followed by
+ * their glyphs and appended to the tail block.  full blocks are packed
+ * with lz_pack() and only unpacked again while the viewport shows them.
+ */
+
+/* pack n bytes into at most max, 0 when they do not fit */
+size_t
+lz_pack(const uint8_t *in, size_t n, uint8_t *out, size_t max) {
+	int32_t tab[LZ_HASH];
+	size_t i, o, lit, len, off, k;
+	uint32_t h;
+
+	memset(tab, 0xff, sizeof(tab));
+	i = o = lit = 0;
+
+	while (i + LZ_MIN <= n) {
+		h = (in[i] | in[i + 1] << 8 | in[i + 2] << 16) * 2654435761u;
+		h >>= 32 - LZ_HASH_BITS;
+		off = i - tab[h];
+
+		if (tab[h] < 0 || off > 0xffff || memcmp(in + tab[h], in + i, LZ_MIN)) {
+			tab[h] = i++;
+			continue;
+		}
+		tab[h] = i;
+
+		for (len = LZ_MIN; i + len < n && len < LZ_MIN + 127; len++)
+			if (in[i - off + len] != in[i + len])
+				break;
+
+		for (; lit < i; lit += k) {
+			k = i - lit < 128 ? i - lit : 128;
+			if (o + 1 + k > max)
+				return 0;
+			out[o++] = k - 1;
+			memcpy(out + o, in + lit, k);
+			o += k;
+		}
+
+		if (o + 3 > max)
+			return 0;
+		out[o++] = 0x80 | (len - LZ_MIN);
+		out[o++] = off & 0xff;
+		out[o++] = off >> 8;
+		i = lit = i + len;
+	}
+
+	for (; lit < n; lit += k) {
+		k = n - lit < 128 ? n - lit : 128;
+		if (o + 1 + k > max)
+			return 0;
+		out[o++] = k - 1;
+		memcpy(out + o, in + lit, k);
+		o += k;
+	}
+
+	return o;
+}
+
+void
+lz_unpack(const uint8_t *in, size_t n, uint8_t *out) {
+	size_t i, o, len, off;
+
+	for (i = o = 0; i < n;) {
+		if (in[i] < 0x80) {
+			len = in[i++] + 1;
+			memcpy(out + o, in + i, len);
+			i += len;
+			o += len;
+		} else {
+			len = (in[i] & 0x7f) + LZ_MIN;
+			off = in[i + 1] | in[i + 2] << 8;
+			i += 3;
+			/* matches may overlap their own output */
+			for (; len; len--, o++)
+				out[o] = out[o - off];
+		}
+	}
+}
+
+/* a block that does not get smaller stays unpacked */
+void
+hist_pack(struct hist_block *b) {
+	uint8_t *p, *q;
+	size_t n;
+
+	if (b->len < 2 || (p = malloc(b->len - 1)) == NULL)
+		return;
+
+	if ((n = lz_pack(b->data, b->len, p, b->len - 1)) == 0) {
+		free(p);
+		return;
+	}
+
+	if ((q = realloc(p, n)) != NULL)
+		p = q;
+
+	term.hist.mem += n;
+	term.hist.mem -= b->size;
+	free(b->data);
+	b->data = p;
+	b->size = b->plen = n;
+}
+
+/* raw encoded lines of b */
+uint8_t *
+hist_unpack(struct hist_block *b) {
+	struct history *h = &term.hist;
+
+	if (!b->plen)
+		return b->data;
+
+	if (h->cached == b)
+		return h->buf;
+
+	if (h->bufsiz < b->len) {
+		if ((h->buf = realloc(h->buf, b->len)) == NULL)
+			err(1, "realloc");
+		h->bufsiz = b->len;
+	}
+
+	lz_unpack(b->data, b->plen, h->buf);
+	h->cached = b;
+
+	return h->buf;
+}
+
+void
+hist_drop() {
+	struct history *h = &term.hist;
+	struct hist_block *b;
+
+	b = h->head;
+	if ((h->head = b->next) == NULL)
+		h->tail = NULL;
+	else
+		h->head->prev = NULL;
+
+	if (h->cached == b)
+		h->cached = NULL;
+
+	h->lines -= b->nlines;
+	h->mem -= b->size + sizeof(*b);
+	if (term.view > h->lines)
+		term.view = h->lines;
+	sel_drop(&term.sel, b->nlines);
+	sel_drop(&term.clip, b->nlines);
+
+	free(b->data);
+	free(b);
+}
+
+void
+hist_clear() {
+	while (term.hist.head)
+		hist_drop();
+
+	term.view = 0;
+}
+
+void
+hist_push(struct tattr *row) {
+	struct history *h = &term.hist;
+	struct hist_block *b;
+	struct style *st;
+	uint8_t *p;
+	uint16_t ncells, nruns, len;
+	size_t n;
+	int x, start;
+
+	if (h->max <= 0)
+		return;
+
+	for (ncells = term.width; ncells; ncells--)
+		if (row[ncells - 1].ch || row[ncells - 1].style)
+			break;
+
+	for (x = nruns = 0; x < ncells; nruns++)
+		for (start = x++; x < ncells; x++)
+			if (!SAME_ATTR(row[x], row[start]))
+				break;
+
+	b = h->tail;
+	if (b == NULL || b->nlines >= HIST_BLOCK_LINES) {
+		if (b != NULL)
+			hist_pack(b);
+
+		if ((b = calloc(1, sizeof(*b))) == NULL)
+			err(1, "calloc");
+
+		if ((b->prev = h->tail) != NULL)
+			h->tail->next = b;
+		else
+			h->head = b;
+		h->tail = b;
+		h->mem += sizeof(*b);
+	}
+
+	n = HIST_LINE_SIZE + nruns * HIST_RUN_SIZE + ncells * HIST_GLYPH_SIZE;
+	if (b->len + n > b->size) {
+		h->mem -= b->size;
+		b->size = (b->len + n) * 2;
+		if ((b->data = realloc(b->data, b->size)) == NULL)
+			err(1, "realloc");
+		h->mem += b->size;
+	}
+
+	p = b->data + b->len;
+	memcpy(p, &ncells, 2);
+	memcpy(p + 2, &nruns, 2);
+	/* the line wrapped even when its last cell was trimmed */
+	p[4] = row[term.width - 1].flags & WRAPPED;
+	p += HIST_LINE_SIZE;
+
+	for (x = 0; x < ncells;) {
+		for (start = x++; x < ncells; x++)
+			if (!SAME_ATTR(row[x], row[start]))
+				break;
+
+		/* the style itself, indices do not outlive style_collect() */
+		len = x - start;
+		memcpy(p, &len, 2);
+		st = &term.styles[row[start].style];
+		memcpy(p + 2, &st->fg, 4);
+		memcpy(p + 6, &st->bg, 4);
+		memcpy(p + 10, &st->ul, 4);
+		memcpy(p + 14, &st->attr, 2);
+		p[16] = row[start].flags;
+		p += HIST_RUN_SIZE;
+	}
+
+	for (x = 0; x < ncells; x++, p += HIST_GLYPH_SIZE) {
+		p[0] = row[x].ch;
+		p[1] = row[x].ch >> 8;
+		p[2] = row[x].ch >> 16;
+	}
+
+	b->len = p - b->data;
+	b->nlines++;
+	h->lines++;
+
+	/* keep the viewport on the same lines while output scrolls by */
+	if (term.view)
+		term.view++;
+
+	while (h->head != h->tail && (h->lines - h->head->nlines >= h->max
+				|| h->mem > HIST_MEM_MAX))
+		hist_drop();
+}
+
+/* decode history line n, counted from the oldest, into a scratch row */
+struct tattr *
+hist_line(int n) {
+	struct history *h = &term.hist;
+	struct hist_block *b;
+	struct tattr *row;
+	struct style st;
+	uint8_t *p, *g;
+	uint16_t ncells, nruns, len, id;
+	int first, x, i;
+
+	row = h->line;
+	memset(row, 0, term.width * sizeof(*row));
+
+	/* the viewport is near the bottom, so search from the tail */
+	first = h->lines;
+	for (b = h->tail; b != NULL; b = b->prev) {
+		first -= b->nlines;
+		if (n >= first)
+			break;
+	}
+	if (b == NULL)
+		return row;
+
+	p = hist_unpack(b);
+	for (i = first; ; i++) {
+		memcpy(&ncells, p, 2);
+		memcpy(&nruns, p + 2, 2);
+		if (i == n)
+			break;
+
+		p += HIST_LINE_SIZE + nruns * HIST_RUN_SIZE + ncells * HIST_GLYPH_SIZE;
+	}
+
+	g = p + HIST_LINE_SIZE + nruns * HIST_RUN_SIZE;
+	row[term.width - 1].flags = p[4];
+	p += HIST_LINE_SIZE;
+	for (x = 0; nruns--; p += HIST_RUN_SIZE) {
+		memcpy(&len, p, 2);
+		memcpy(&st.fg, p + 2, 4);
+		memcpy(&st.bg, p + 6, 4);
+		memcpy(&st.ul, p + 10, 4);
+		memcpy(&st.attr, p + 14, 2);
+		id = style_id(&st);
+
+		for (; len--; x++, g += HIST_GLYPH_SIZE) {
+			if (x >= term.width)
+				continue;
+
+			row[x].ch = g[0] | g[1] << 8 | g[2] << 16;
+			row[x].style = id;
+			row[x].flags |= p[16] & ~WRAPPED;
+		}
+	}
+
+	return row;
+}
+
+/* cells shown on row y of the window, which may be scrolled back */
+struct tattr *
+view_row(int y) {
+	int n;
+
+	n = term.hist.lines - term.view + y;
+	if (y >= term.view)
+		return sel_row(ROW(y - term.view), n);
+
+	return sel_row(hist_line(n), n);
+}
+
+void
+view_scroll(int n) {
+	int view;
+
+	view = term.view + n;
+	if (view > term.hist.lines)
+		view = term.hist.lines;
+	if (view < 0)
+		view = 0;
+
+	if (view != term.view) {
+		scroll_view(0, term.height, term.view - view);
+		term.view = view;
+	}
+}
+
+/*
+ * selection
+ *
+ * counting lines from the oldest in history keeps a selection on its text
+ * while output scrolls by; only dropping history moves it.  the text is
+ * extracted by sel_text() when someone asks for it, never before
+ */
+
+/* line n of history, then the screen */
+struct tattr *
+sel_line(int n) {
+	if (n < term.hist.lines)
+		return hist_line(n);
+
+	return ROW(n - term.hist.lines);
+}
+
+int
+sel_delim(const struct tattr *c) {
+	if (c->flags & WDUMMY)
+		return 0;
+
+	return c->ch == 0 || (c->ch < 0x80 && strchr(WORD_DELIM, c->ch));
+}
+
+/* order anchor and point into b and e, widened to words or lines */
+void
+sel_snap(struct xt_sel *s) {
+	struct tattr *row;
+	struct xt_cursor t;
+	int last;
+
+	s->b = s->anchor;
+	s->e = s->point;
+	if (s->b.y > s->e.y || (s->b.y == s->e.y && s->b.x > s->e.x)) {
+		t = s->b;
+		s->b = s->e;
+		s->e = t;
+	}
+
+	switch (s->snap) {
+	case SEL_WORD:
+		row = sel_line(s->b.y);
+		if (!sel_delim(&row[s->b.x]))
+			while (s->b.x > 0 && !sel_delim(&row[s->b.x - 1]))
+				s->b.x--;
+
+		row = sel_line(s->e.y);
+		if (!sel_delim(&row[s->e.x]))
+			while (s->e.x < term.width - 1 && !sel_delim(&row[s->e.x + 1]))
+				s->e.x++;
+		break;
+	case SEL_LINE:
+		/* with the rows a long line wrapped onto */
+		last = term.hist.lines + term.rows - 1;
+		while (s->b.y > 0 && sel_line(s->b.y - 1)[term.width - 1].flags & WRAPPED)
+			s->b.y--;
+		while (s->e.y < last && sel_line(s->e.y)[term.width - 1].flags & WRAPPED)
+			s->e.y++;
+
+		s->b.x = 0;
+		s->e.x = term.width - 1;
+		break;
+	}
+
+	/* wide characters are selected whole */
+	if (s->b.x > 0 && sel_line(s->b.y)[s->b.x].flags & WDUMMY)
+		s->b.x--;
+	if (s->e.x < term.width - 1 && sel_line(s->e.y)[s->e.x].flags & WIDE)
+		s->e.x++;
+}
+
+/* damage the rows of s the viewport shows */
+void
+sel_damage(const struct xt_sel *s) {
+	int y, y0, y1;
+
+	if (!s->on)
+		return;
+
+	y0 = s->b.y - (term.hist.lines - term.view);
+	y1 = s->e.y - (term.hist.lines - term.view);
+	for (y = y0 < 0 ? 0 : y0; y <= y1 && y < term.height; y++)
+		damage_view(0, term.width, y);
+}
+
+/* the cell x, y of the window, counted as a selection does */
+void
+sel_point(struct xt_cursor *p, int x, int y) {
+	p->x = x;
+	p->y = term.hist.lines - term.view + y;
+}
+
+/* start selecting at window cell x, y, a click alone selects no characters */
+void
+sel_start(struct xt_sel *s, int x, int y, int snap) {
+	sel_damage(s);
+
+	sel_point(&s->anchor, x, y);
+	s->point = s->anchor;
+	s->snap = snap;
+	s->on = snap != SEL_CHAR;
+	sel_snap(s);
+
+	sel_damage(s);
+}
+
+/* drag the end of the selection to window cell x, y */
+void
+sel_extend(struct xt_sel *s, int x, int y) {
+	struct xt_cursor p;
+
+	sel_point(&p, x, y);
+	if (p.x == s->point.x && p.y == s->point.y)
+		return;
+
+	sel_damage(s);
+
+	s->point = p;
+	s->on = 1;
+	sel_snap(s);
+
+	sel_damage(s);
+}
+
+void
+sel_clear(struct xt_sel *s) {
+	sel_damage(s);
+	s->on = 0;
+}
+
+/* history lost its n oldest lines */
+void
+sel_drop(struct xt_sel *s, int n) {
+	struct xt_cursor *p[] = { &s->anchor, &s->point, &s->b, &s->e };
+	size_t i;
+
+	if (!s->on)
+		return;
+
+	if (s->e.y < n) {
+		s->on = 0;
+		return;
+	}
+
+	for (i = 0; i < LEN(p); i++) {
+		p[i]->y -= n;
+		if (p[i]->y < 0)
+			p[i]->x = p[i]->y = 0;
+	}
+}
+
+/* row n as shown, with the selected cells in reverse video */
+struct tattr *
+sel_row(struct tattr *row, int n) {
+	struct xt_sel *s = &term.sel;
+	struct style st;
+	uint16_t id, rid;
+	int x, x1;
+
+	if (!s->on || n < s->b.y || n > s->e.y)
+		return row;
+
+	memcpy(term.selrow, row, term.width * sizeof(*row));
+
+	x1 = n == s->e.y ? s->e.x + 1 : term.width;
+	if (x1 > term.width)
+		x1 = term.width;
+
+	/* style_id() may renumber, row and selrow with it */
+	for (x = n == s->b.y ? s->b.x : 0, id = rid = STYLE_NONE; x < x1; x++) {
+		if (row[x].style != id) {
+			id = row[x].style;
+			st = term.styles[id];
+			st.attr ^= REVERSE;
+			rid = style_id(&st);
+		}
+		term.selrow[x].style = rid;
+	}
+
+	return term.selrow;
+}
+
+/*
+ * the text of s as utf-8, in a buffer the caller frees.  rows end in a
+ * newline unless the line wrapped on to the next, blanks at the end of a
+ * line are dropped
+ */
+char *
+sel_text(const struct xt_sel *s, size_t *len) {
+	struct tattr *row;
+	char *buf, *p;
+	int n, x, x1, end, wrapped;
+
+	buf = malloc((size_t)(s->e.y - s->b.y + 1) * (term.width * 4 + 1));
+	if (buf == NULL)
+		err(1, "malloc");
+
+	for (p = buf, n = s->b.y; n <= s->e.y; n++) {
+		row = sel_line(n);
+		wrapped = row[term.width - 1].flags & WRAPPED;
+
+		x1 = n == s->e.y ? s->e.x + 1 : term.width;
+		if (x1 > term.width)
+			x1 = term.width;
+
+		/* a wrapped line keeps its spaces, not a wide character's gap */
+		end = x1;
+		while (end > 0 && (row[end - 1].ch == 0 || (row[end - 1].ch == ' '
+					&& (!wrapped || n == s->e.y)))
+				&& !(row[end - 1].flags & WDUMMY))
+			end--;
+
+		for (x = n == s->b.y ? s->b.x : 0; x < end; x++) {
+			if (row[x].flags & WDUMMY)
+				continue;
+
+			if (row[x].ch)
+				p += utf_encode(row[x].ch, p);
+			else
+				*p++ = ' ';
+		}
+
+		if (n < s->e.y && !wrapped)
+			*p++ = '\n';
+	}
+
+	*len = p - buf;
+	return buf;
+}
+
+void
+clear_cells(int y, int x0, int x1) {
+	struct tattr *row;
+	int x;
+
+	row = ROW(y);
+	for (x = x0; x < x1; x++) {
+		row[x].ch = row[x].flags = 0;
+		row[x].style = term.blankid;
+	}
+
+	damage(x0, x1, y);
+}
+
+/* ICH: the cells from x on move n to the right, the gap is blanked */
+void
+insert_cells(int y, int x, int n) {
+	struct tattr *row;
+	uint8_t wrapped;
+
+	if (n > term.width - x)
+		n = term.width - x;
+	if (n <= 0)
+		return;
+
+	row = ROW(y);
+	wrapped = row[term.width - 1].flags & WRAPPED;
+
+	/* never leave half of a wide character behind */
+	if (row[x].flags & WDUMMY && x > 0) {
+		row[x - 1].ch = row[x].ch = 0;
+		row[x - 1].flags &= ~WIDE;
+		row[x].flags &= ~WDUMMY;
+	}
+
+	memmove(row + x + n, row + x, (term.width - x - n) * sizeof(*row));
+	clear_cells(y, x, x + n);
+
+	/* nor where the right margin cuts one off */
+	if (row[term.width - 1].flags & WIDE) {
+		row[term.width - 1].ch = 0;
+		row[term.width - 1].flags &= ~WIDE;
+	}
+	row[term.width - 1].flags |= wrapped;
+
+	damage(x, term.width, y);
+}
+
+/*
+ * move screen rows y0..y1 up by n, or down for negative n, and clear the
+ * rows left behind.  the whole screen scrolls up by turning the ring and
+ * saves what leaves it to history, a region copies its rows in place
+ */
+void
+scroll(int y0, int y1, int n) {
+	int y, k, view;
+
+	k = n < 0 ? -n : n;
+	if (k > y1 - y0)
+		k = y1 - y0;
+	if (k == 0)
+		return;
+
+	if (n > 0 && y0 == 0 && y1 == term.height) {
+		while (k--) {
+			/* a scrolled back viewport stays on the lines it shows */
+			view = term.view;
+			if (!term.altscreen)
+				hist_push(ROW(0));
+
+			if (term.view == view)
+				scroll_view(term.view, term.height, 1);
+			else if (term.view != view + 1)
+				damage_all();
+
+			/* the top slot becomes the new bottom row */
+			term.top = (term.top + 1) % term.rows;
+			clear_cells(term.rows - 1, 0, term.width);
+		}
+		return;
+	}
+
+	/* only the rows that come into the region are painted */
+	scroll_view(y0 + term.view, y1 + term.view, n < 0 ? -k : k);
+
+	if (n > 0) {
+		for (y = y0; y < y1 - k; y++)
+			memcpy(ROW(y), ROW(y + k), term.width * sizeof(struct tattr));
+		for (; y < y1; y++)
+			clear_cells(y, 0, term.width);
+	} else {
+		for (y = y1 - 1; y >= y0 + k; y--)
+			memcpy(ROW(y), ROW(y - k), term.width * sizeof(struct tattr));
+		for (; y >= y0; y--)
+			clear_cells(y, 0, term.width);
+	}
+}
+
+/* move the cursor down a line, the region scrolls at its bottom margin */
+void
+linefeed() {
+	term.wrapnext = 0;
+
+	if (term.cursor.y == term.margin1 - 1)
+		scroll(term.margin0, term.margin1, 1);
+	else if (term.cursor.y + 1 < term.height)
+		term.cursor.y++;
+}
+
+/* the same upwards, for RI */
+void
+reverse_linefeed() {
+	term.wrapnext = 0;
+
+	if (term.cursor.y == term.margin0)
+		scroll(term.margin0, term.margin1, -1);
+	else if (term.cursor.y > 0)
+		term.cursor.y--;
+}
+
+/* go on at the start of the next line, the row remembers it wrapped */
+void
+wrap() {
+	ROW(term.cursor.y)[term.width - 1].flags |= WRAPPED;
+	term.cursor.x = 0;
+	linefeed();
+}
+
+int
+utf_encode(uint32_t c, char *s) {
+	if (c < 0x80) {
+		s[0] = c;
+		return 1;
+	} else if (c < 0x800) {
+		s[0] = 0xc0 | c >> 6;
+		s[1] = 0x80 | (c & 0x3f);
+		return 2;
+	} else if (c < 0x10000) {
+		s[0] = 0xe0 | c >> 12;
+		s[1] = 0x80 | (c >> 6 & 0x3f);
+		s[2] = 0x80 | (c & 0x3f);
+		return 3;
+	}
+
+	s[0] = 0xf0 | c >> 18;
+	s[1] = 0x80 | (c >> 12 & 0x3f);
+	s[2] = 0x80 | (c >> 6 & 0x3f);
+	s[3] = 0x80 | (c & 0x3f);
+	return 4;
+}
+
+int
+utf_len(char *str) {
+	uint8_t *utf = (uint8_t *)str;
+
+	if (utf[0] < 0x80)
+		return 1;
+	else if ((utf[0] & 0xe0) == 0xc0)
+		return 2;
+	else if ((utf[0] & 0xf0) == 0xe0)
+		return 3;
+	else if ((utf[0] & 0xf8) == 0xf0)
+		return 4;
+	else if ((utf[0] & 0xfc) == 0xf8)
+		return 5;
+	else if ((utf[0] & 0xfe) == 0xfc)
+		return 6;
+
+	return 1;
+}
+
+/*
+ * the length of the utf-8 sequence at s once all of its n bytes are seen
+ * to continue it, 0 when n cuts it off, -1 when one does not; only the
+ * lead byte is taken then, the other starts over
+ */
+int
+utf_seq(const char *s, size_t n) {
+	const uint8_t *p = (const uint8_t *)s;
+	int i, l;
+
+	l = utf_len((char *)s);
+	for (i = 1; i < l; i++) {
+		if ((size_t)i >= n)
+			return 0;
+		if ((p[i] & 0xc0) != 0x80)
+			return -1;
+	}
+
+	return l;
+}
+
+uint32_t
+utf_combine(const char *str) {
+	uint32_t c;
+	uint8_t *utf = (uint8_t *)str;
+
+	switch (utf_len((char *)str)) {
+	case 1:
+		/* a stray continuation byte */
+		c = utf[0] < 0x80 ? utf[0] : 0xfffd;
+		break;
+	case 2:
+		c = (utf[0] & 0x1f) << 6 | (utf[1] & 0x3f);
+		break;
+	case 3:
+		c = (utf[0] & 0xf) << 12 | (utf[1] & 0x3f) << 6 | (utf[2] & 0x3f);
+		break;
+	case 4:
+		c = (utf[0] & 0x7) << 18 | (utf[1] & 0x3f) << 12
+			| (utf[2] & 0x3f) << 6 | (utf[3] & 0x3f);
+		break;
+	default:
+		c = 0xfffd;
+		break;
+	}
+
+	return c > 0x10ffff ? 0xfffd : c;
+}
+
+/* columns codepoint c takes, nothing below U+0300 is wide or combining */
+static inline int
+char_width(uint32_t c) {
+	if (c < 0x300)
+		return 1;
+
+	return width_stage2[width_stage1[c >> 8]][(c & 0xff) >> 2] >> (c & 3) * 2 & 3;
+}
+
+/* put c into cell x, and for a wide character the continuation after it */
+void
+set_cell(int x, int y, uint32_t ch, int w) {
+	struct tattr *row, *c;
+
+	if (x < 0 || y < 0) {
+		DEBUG("OUT OF BOUNDS!, negative; trying to write to x:%d y:%d", x, y);
+		return;
+	}
+	if (x >= term.width || y >= term.rows) {
+		DEBUG("OUT OF BOUNDS!, positive; trying to write to x:%d y:%d", x, y);
+		return;
+	}
+
+	row = ROW(y);
+	c = row + x;
+
+	/* never leave half of a wide character behind */
+	if (c->flags & WDUMMY && x > 0) {
+		row[x - 1].ch = 0;
+		row[x - 1].flags &= ~WIDE;
+		damage(x - 1, x, y);
+	}
+	if (c->flags & WIDE && x + 1 < term.width) {
+		row[x + 1].ch = 0;
+		row[x + 1].flags &= ~WDUMMY;
+		damage(x + 1, x + 2, y);
+	}
+
+	c->ch = ch;
+	c->style = term.penid;
+	c->flags = 0;
+	damage(x, x + 1, y);
+
+	if (w == 2 && x + 1 < term.width) {
+		c->flags = WIDE;
+		if (c[1].flags & WIDE && x + 2 < term.width) {
+			c[2].ch = 0;
+			c[2].flags &= ~WDUMMY;
+		}
+
+		c[1].ch = 0;
+		c[1].style = term.penid;
+		c[1].flags = WDUMMY;
+		damage(x + 1, x + 3, y);
+	}
+}
+
+int
+valid_xy(int x, int y) {
+	if (x >= term.width || x < 0)
+		return 0;
+
+	if (y >= term.height || y < 0)
+		return 0;
+
+	return 1;
+}
+
+/* CUP and friends: clamped to the screen, or to the region under DECOM */
+void
+cursor_to(int x, int y) {
+	int y0, y1;
+
+	y0 = term.origin ? term.margin0 : 0;
+	y1 = term.origin ? term.margin1 : term.height;
+
+	term.cursor.x = x < 0 ? 0 : x >= term.width ? term.width - 1 : x;
+	term.cursor.y = y < y0 ? y0 : y >= y1 ? y1 - 1 : y;
+	term.wrapnext = 0;
+}
+
+void
+cursor_save() {
+	term.saved.cursor = term.cursor;
+	term.saved.pen = term.pen;
+}
+
+void
+cursor_restore() {
+	term.cursor = term.saved.cursor;
+	term.wrapnext = 0;
+
+	/* the terminal may have shrunk since */
+	if (term.cursor.x >= term.width)
+		term.cursor.x = term.width - 1;
+	if (term.cursor.y >= term.height)
+		term.cursor.y = term.height - 1;
+	term.pen = term.saved.pen;
+	pen_update();
+}
+
+/* switch grids by swapping the rings, neither one is copied */
+void
+altscreen(int on) {
+	struct tattr *map;
+	int top;
+
+	if (on == term.altscreen)
+		return;
+
+	map = term.map;
+	term.map = term.alt;
+	term.alt = map;
+
+	top = term.top;
+	term.top = term.alttop;
+	term.alttop = top;
+
+	term.altscreen = on;
+	term.view = 0;
+	damage_all();
+}
+
+/*
+ * the color after 38, 48 or 58: 5;n or 2;r;g;b, or the same with colons,
+ * where 2 may carry a colorspace id before r.  returns how many of the n
+ * parameters at p it takes
+ */
+int
+sgr_color(const int *p, int n, int colon, uint32_t *c) {
+	if (n < 1)
+		return 0;
+
+	switch (p[0]) {
+	case 2:
+		if (colon && n >= 5) {
+			p++;
+			n--;
+		}
+		if (n >= 4)
+			*c = COLOR_RGB((p[1] & 0xff) << 16 | (p[2] & 0xff) << 8
+					| (p[3] & 0xff));
+		return n < 4 ? n : 4;
+	case 5:
+		if (n >= 2)
+			*c = COLOR_PAL(p[1] & 0xff);
+		return n < 2 ? n : 2;
+	}
+
+	return 1;
+}
+
+/*
+ * select graphic rendition from the decoded parameters.  a parameter may
+ * be followed by colon separated sub-parameters (term.sub), which are
+ * its own and skipped along with it when not understood
+ */
+void
+sgr(int *arg, int narg) {
+	struct style *pen = &term.pen;
+	uint32_t *c;
+	int i, n, nsub;
+
+	if (narg == 0)
+		memset(pen, 0, sizeof(*pen));
+
+	for (i = 0; i < narg; i += 1 + nsub) {
+		for (nsub = 0; i + nsub + 1 < narg
+				&& term.sub & 1 << (i + nsub + 1); nsub++)
+			;
+
+		switch (arg[i]) {
+		case 0:
+			memset(pen, 0, sizeof(*pen));
+			break;
+		case 1:
+			pen->attr |= BOLD;
+			break;
+		case 2:
+			pen->attr |= DIM;
+			break;
+		case 3:
+			pen->attr |= ITALIC;
+			break;
+		case 4:
+			/* 4:0 turns it off, 4:3 is curly and so on */
+			n = nsub ? arg[i + 1] : UL_SINGLE;
+			if (n > UL_DASHED)
+				break;
+
+			pen->attr &= ~(UNDERLINE | UL_STYLE);
+			if (n) {
+				pen->attr |= UNDERLINE;
+				UL_SET(pen->attr, n);
+			}
+			break;
+		case 5:
+		case 6:
+			pen->attr |= BLINK;
+			break;
+		case 7:
+			pen->attr |= REVERSE;
+			break;
+		case 8:
+			pen->attr |= INVISIBLE;
+			break;
+		case 9:
+			pen->attr |= STRUCK;
+			break;
+		case 21:
+			pen->attr |= UNDERLINE;
+			UL_SET(pen->attr, UL_DOUBLE);
+			break;
+		case 22:
+			pen->attr &= ~(BOLD | DIM);
+			break;
+		case 23:
+			pen->attr &= ~ITALIC;
+			break;
+		case 24:
+			pen->attr &= ~(UNDERLINE | UL_STYLE);
+			break;
+		case 25:
+			pen->attr &= ~BLINK;
+			break;
+		case 27:
+			pen->attr &= ~REVERSE;
+			break;
+		case 28:
+			pen->attr &= ~INVISIBLE;
+			break;
+		case 29:
+			pen->attr &= ~STRUCK;
+			break;
+		case 30 ... 37:
+			pen->fg = COLOR_PAL(arg[i] - 30);
+			break;
+		case 38:
+		case 48:
+		case 58:
+			c = arg[i] == 38 ? &pen->fg : arg[i] == 48 ? &pen->bg : &pen->ul;
+			if (nsub)
+				sgr_color(arg + i + 1, nsub, 1, c);
+			else
+				nsub = sgr_color(arg + i + 1, narg - i - 1, 0, c);
+			break;
+		case 39:
+			pen->fg = 0;
+			break;
+		case 40 ... 47:
+			pen->bg = COLOR_PAL(arg[i] - 40);
+			break;
+		case 49:
+			pen->bg = 0;
+			break;
+		case 53:
+			pen->attr |= OVERLINE;
+			break;
+		case 55:
+			pen->attr &= ~OVERLINE;
+			break;
+		case 59:
+			pen->ul = 0;
+			break;
+		case 90 ... 97:
+			pen->fg = COLOR_PAL(arg[i] - 90 + 8);
+			break;
+		case 100 ... 107:
+			pen->bg = COLOR_PAL(arg[i] - 100 + 8);
+			break;
+		}
+	}
+
+	pen_update();
+}
+
+void
+csiseq(int final) {
+	int *arg;
+	int i, s;
+
+	arg = term.arg;
+
+	/* everything but sgr takes the cursor off a pending wrap */
+	if (final != 'm')
+		term.wrapnext = 0;
+
+	switch (final) {
+	case 'A':
+	case 'B':
+	case 'C':
+	case 'D':
+		for (s = DEFARG(0, 1); s; s--)
+			cursormv(final);
+		break;
+	case 'E':
+	case 'F':
+		for (s = DEFARG(0, 1); s; s--)
+			cursormv(final == 'E' ? DOWN : UP);
+
+		term.cursor.x = 0;
+		break;
+	case 'G': /* CHA */
+		cursor_to(DEFARG(0, 1) - 1, term.cursor.y);
+		break;
+	case 'f':
+	case 'H': /* CUP: n ; m H */
+		s = term.origin ? term.margin0 : 0;
+		cursor_to(DEFARG(1, 1) - 1, DEFARG(0, 1) - 1 + s);
+		break;
+	case 'J':
+		switch (arg[0]) {
+		case 3: /* clear screen and wipe scrollback */
+			hist_clear();
+			damage_all();
+			/* FALLTHROUGH */
+		case 2: /* clear entire screen */
+			FOREACH_ROW(i)
+				clear_cells(i, 0, term.width);
+			break;
+		case 1: /* clear from cursor to beginning of screen */
+			for (i = 0; i < term.cursor.y; i++)
+				clear_cells(i, 0, term.width);
+			clear_cells(term.cursor.y, 0, term.cursor.x + 1);
+			break;
+		case 0: /* clear from cursor to end of screen (default) */
+			clear_cells(term.cursor.y, term.cursor.x, term.width);
+			for (i = term.cursor.y + 1; i < term.rows; i++)
+				clear_cells(i, 0, term.width);
+			break;
+		}
+		break;
+	case 'K': /* EL erase in line */
+		switch (arg[0]) {
+		default:
+		case 0:
+			clear_cells(term.cursor.y, term.cursor.x, term.width);
+			break;
+		case 1:
+			clear_cells(term.cursor.y, 0, term.cursor.x + 1);
+			break;
+		case 2:
+			clear_cells(term.cursor.y, 0, term.width);
+			break;
+		}
+		break;
+	case 'L': /* IL insert lines */
+	case 'M': /* DL delete lines */
+		if (term.cursor.y < term.margin0 || term.cursor.y >= term.margin1)
+			break;
+
+		s = DEFARG(0, 1);
+		scroll(term.cursor.y, term.margin1, final == 'M' ? s : -s);
+		term.cursor.x = 0;
+		break;
+	case 'S': /* SU scroll up */
+	case 'T': /* SD scroll down, with more arguments mouse tracking */
+		if (term.priv || (final == 'T' && term.narg > 1))
+			break;
+
+		s = DEFARG(0, 1);
+		scroll(term.margin0, term.margin1, final == 'S' ? s : -s);
+		break;
+	case 'r': /* DECSTBM set top and bottom margins */
+		if (term.priv)
+			break;
+
+		i = DEFARG(0, 1) - 1;
+		s = DEFARG(1, term.height);
+		if (s > term.height)
+			s = term.height;
+		if (i + 1 >= s)
+			break;
+
+		term.margin0 = i;
+		term.margin1 = s;
+		cursor_to(0, term.origin ? term.margin0 : 0);
+		break;
+	case 'l':
+	case 'h':
+		if (term.priv != '?')
+			break;
+
+		for (i = 0; i < term.narg; i++) {
+			switch (arg[i]) {
+			case 6: /* DECOM origin mode, homes the cursor */
+				term.origin = final == 'h';
+				cursor_to(0, term.origin ? term.margin0 : 0);
+				break;
+			case 25: /* show or hide cursor */
+				term.cursor_vis = final == 'h';
+				break;
+			case 1049: /* alternative screen buffer, saving the cursor */
+				if (final == 'h') {
+					cursor_save();
+					altscreen(1);
+					FOREACH_ROW(s)
+						clear_cells(s, 0, term.width);
+				} else {
+					altscreen(0);
+					cursor_restore();
+				}
+				break;
+			case 1047: /* alternative screen buffer, cleared on exit */
+				if (final == 'l' && term.altscreen)
+					FOREACH_ROW(s)
+						clear_cells(s, 0, term.width);
+				/* FALLTHROUGH */
+			case 47: /* alternative screen buffer */
+				altscreen(final == 'h');
+				break;
+			case 2004: /* bracketed paste mode */
+				term.bracketed = final == 'h';
+				break;
+			}
+		}
+		break;
+	case 'm':
+		if (term.priv == 0)
+			sgr(arg, term.narg);
+		break;
+	case 's': /* SCP save cursor position */
+		cursor_save();
+		break;
+	case 'u': /* RCP restore cursor position */
+		cursor_restore();
+		break;
+	case 'd': /* VPA */
+		s = term.origin ? term.margin0 : 0;
+		cursor_to(term.cursor.x, DEFARG(0, 1) - 1 + s);
+		break;
+	case '@': /* ICH insert blanks */
+		insert_cells(term.cursor.y, term.cursor.x, DEFARG(0, 1));
+		break;
+	default:
+		DEBUG("unknown escape type: '%c' (0x%x)", final, final);
+		break;
+	}
+}
+
+void
+escseq(int final) {
+	switch (final) {
+	case '7': /* DECSC save cursor */
+		cursor_save();
+		break;
+	case '8': /* DECRC restore cursor */
+		cursor_restore();
+		break;
+	case 'D': /* IND index */
+		linefeed();
+		break;
+	case 'E': /* NEL next line */
+		linefeed();
+		term.cursor.x = 0;
+		break;
+	case 'M': /* RI reverse index */
+		reverse_linefeed();
+		break;
+	case '\\': /* ST, ends an OSC or DCS string */
+		break;
+	case '=': /* DECKPAM */
+	case '>': /* DECKPNM */
+		break;
+	default:
+		DEBUG("unknown escape: '%c' (0x%x)", final, final);
+		break;
+	}
+}
+
+void
+ctrl(int c) {
+	switch (c) {
+	case '\t':
+		/* tab stops are fixed every 8 columns */
+		term.cursor.x = (term.cursor.x / 8 + 1) * 8;
+		if (term.cursor.x >= term.width)
+			term.cursor.x = term.width - 1;
+		term.wrapnext = 0;
+		break;
+	case '\b':
+		cursormv(LEFT);
+		break;
+	case '\r':
+		term.cursor.x = 0;
+		term.wrapnext = 0;
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		linefeed();
+		break;
+	default:
+		/* NUL, BEL and the rest are ignored */
+		break;
+	}
+}
+
+void
+term_putc(uint32_t c) {
+	int w;
+
+	/* combining marks have no cell of their own and are dropped */
+	if ((w = char_width(c)) == 0)
+		return;
+
+	/* a wide character that does not fit wraps as a whole */
+	if (term.wrapnext || term.cursor.x + w > term.width)
+		wrap();
+
+	set_cell(term.cursor.x, term.cursor.y, c, w);
+
+	/* the cursor stays on the last column until the next character */
+	if (term.cursor.x + w >= term.width) {
+		term.cursor.x = term.width - 1;
+		term.wrapnext = 1;
+	} else
+		term.cursor.x += w;
+}
+
+/*
+ * text runs
+ *
+ * most pty output is printable text between controls.  text_run() finds
+ * how far it goes, 16 or 32 bytes at a time where the cpu allows, and
+ * term_puts() then writes an ascii run into its row in one go.
+ */
+static size_t
+text_run_scalar(const uint8_t *p, size_t n, int *hi) {
+	size_t i;
+	int h;
+
+	for (i = h = 0; i < n && p[i] >= 0x20 && p[i] != 0x7f; i++)
+		h |= p[i];
+
+	*hi = h >> 7;
+	return i;
+}
+
+#ifdef HAVE_SSE2
+static size_t
+text_run_sse2(const uint8_t *p, size_t n, int *hi) {
+	const __m128i flip = _mm_set1_epi8(-0x80);
+	const __m128i space = _mm_set1_epi8(0x20 - 0x80);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	__m128i v, ctl;
+	size_t i;
+	int m, h;
+
+	for (i = h = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+
+		/* unsigned v < 0x20 as a signed compare, or DEL */
+		ctl = _mm_or_si128(_mm_cmplt_epi8(_mm_xor_si128(v, flip), space),
+				_mm_cmpeq_epi8(v, del));
+
+		if ((m = _mm_movemask_epi8(ctl)) != 0) {
+			h |= _mm_movemask_epi8(v) & ((m & -m) - 1);
+			*hi = h != 0;
+			return i + __builtin_ctz(m);
+		}
+		h |= _mm_movemask_epi8(v);
+	}
+
+	i += text_run_scalar(p + i, n - i, hi);
+	*hi |= h != 0;
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t
+text_run_avx2(const uint8_t *p, size_t n, int *hi) {
+	const __m256i flip = _mm256_set1_epi8(-0x80);
+	const __m256i space = _mm256_set1_epi8(0x20 - 0x80);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	__m256i v, ctl;
+	uint32_t m, h;
+	size_t i;
+
+	for (i = h = 0; i + 32 <= n; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		ctl = _mm256_or_si256(_mm256_cmpgt_epi8(space, _mm256_xor_si256(v, flip)),
+				_mm256_cmpeq_epi8(v, del));
+
+		if ((m = _mm256_movemask_epi8(ctl)) != 0) {
+			h |= _mm256_movemask_epi8(v) & ((m & -m) - 1);
+			*hi = h != 0;
+			return i + __builtin_ctz(m);
+		}
+		h |= _mm256_movemask_epi8(v);
+	}
+
+	i += text_run_sse2(p + i, n - i, hi);
+	*hi |= h != 0;
+	return i;
+}
+#endif
+
+static size_t text_run_init(const uint8_t *, size_t, int *);
+
+/*
+ * length of the run at p without C0 controls, ESC or DEL, hi is set when
+ * it holds anything but ascii.  the first call picks the implementation
+ */
+static size_t (*text_run)(const uint8_t *, size_t, int *) = text_run_init;
+
+static size_t
+text_run_init(const uint8_t *p, size_t n, int *hi) {
+	text_run = text_run_scalar;
+#ifdef HAVE_SSE2
+	text_run = text_run_sse2;
+	if (__builtin_cpu_supports("avx2"))
+		text_run = text_run_avx2;
+#endif
+
+	return text_run(p, n, hi);
+}
+
+/* write n bytes of printable ascii at the cursor */
+void
+term_puts(const char *s, size_t n) {
+	struct tattr *row;
+	int i, x, k, room;
+
+	while (n) {
+		if (term.wrapnext)
+			wrap();
+
+		/* up to the end of the line, like term_putc() would */
+		room = term.width - term.cursor.x;
+		k = n < (size_t)room ? (int)n : room;
+		x = term.cursor.x;
+		row = ROW(term.cursor.y);
+
+		/* never leave half of a wide character behind */
+		if (row[x].flags & WDUMMY && x > 0) {
+			row[x - 1].ch = 0;
+			row[x - 1].flags &= ~WIDE;
+			damage(x - 1, x, term.cursor.y);
+		}
+		if (row[x + k - 1].flags & WIDE && x + k < term.width) {
+			row[x + k].ch = 0;
+			row[x + k].flags &= ~WDUMMY;
+			damage(x + k, x + k + 1, term.cursor.y);
+		}
+
+		for (i = 0; i < k; i++) {
+			row[x + i].ch = (uint8_t)s[i];
+			row[x + i].style = term.penid;
+			row[x + i].flags = 0;
+		}
+
+		damage(x, x + k, term.cursor.y);
+		if (x + k >= term.width) {
+			term.cursor.x = term.width - 1;
+			term.wrapnext = 1;
+		} else
+			term.cursor.x += k;
+		s += k;
+		n -= k;
+	}
+}
+
+/*
+ * write a run found by text_run(), ascii in bulk; returns the bytes used,
+ * which stops short of a utf-8 sequence the run cuts off
+ */
+size_t
+put_text(const char *s, size_t n, int hi) {
+	const uint8_t *p, *end;
+	size_t k;
+	int l;
+
+	if (!hi) {
+		term_puts(s, n);
+		return n;
+	}
+
+	p = (const uint8_t *)s;
+	end = p + n;
+	while (p < end) {
+		for (k = 0; p + k < end && p[k] < 0x80; k++)
+			;
+		if (k) {
+			term_puts((const char *)p, k);
+			p += k;
+			continue;
+		}
+
+		if ((l = utf_seq((const char *)p, end - p)) == 0)
+			break;
+		if (l < 0) {
+			term_putc(0xfffd);
+			p++;
+			continue;
+		}
+
+		term_putc(utf_combine((const char *)p));
+		p += l;
+	}
+
+	return p - (const uint8_t *)s;
+}
+
+/*
+ * feed len bytes of pty output to the terminal, in place.  all parser
+ * state lives in term, so a sequence may be split anywhere between calls;
+ * a utf-8 sequence cut off at the end of buf is kept until the next call
+ */
+void
+term_write(const char *buf, size_t len) {
+	const char *p, *end;
+	uint8_t c;
+	size_t n;
+	int l, hi;
+
+	p = buf;
+	end = buf + len;
+
+	if (term.nutf) {
+		while (p < end && term.nutf < utf_len(term.utf)
+				&& (*p & 0xc0) == 0x80)
+			term.utf[term.nutf++] = *p++;
+
+		if (p == end && term.nutf < utf_len(term.utf))
+			return;
+
+		/* cut short by a byte that goes to the parser as it is */
+		term_putc(term.nutf < utf_len(term.utf) ? 0xfffd
+				: utf_combine(term.utf));
+		term.nutf = 0;
+	}
+
+	for (; p < end; p++) {
+		c = *p;
+
+		switch (term.state) {
+		case S_GROUND:
+			switch (byteclass[c]) {
+			case C_CTL:
+				ctrl(c);
+				break;
+			case C_ESC:
+				term.state = S_ESC;
+				term.inter = 0;
+				break;
+			case C_DEL:
+				break;
+			default:
+				n = text_run((const uint8_t *)p, end - p, &hi);
+				if ((n = put_text(p, n, hi)) > 0) {
+					p += n - 1;
+					break;
+				}
+
+				/* a utf-8 sequence cut off by a control or the end of buf */
+				if ((l = utf_seq(p, end - p)) == 0) {
+					memcpy(term.utf, p, end - p);
+					term.nutf = end - p;
+					return;
+				}
+				if (l < 0) {
+					/* the byte after the lead is parsed again */
+					term_putc(0xfffd);
+					break;
+				}
+
+				term_putc(utf_combine(p));
+				p += l - 1;
+				break;
+			}
+			break;
+		case S_ESC:
+			switch (byteclass[c]) {
+			case C_CTL:
+				ctrl(c);
+				break;
+			case C_ESC:
+				break;
+			case C_INTER:
+				term.inter = c;
+				break;
+			case C_DEL:
+				break;
+			default:
+				if (term.inter) {
+					/* charset designation and friends */
+					term.state = S_GROUND;
+				} else if (c == '[') {
+					term.state = S_CSI;
+					term.narg = term.priv = term.sub = 0;
+					memset(term.arg, 0, sizeof(term.arg));
+				} else if (c == ']') {
+					term.state = S_OSC;
+				} else if (c == 'P') {
+					term.state = S_DCS;
+				} else {
+					term.state = S_GROUND;
+					escseq(c);
+				}
+				break;
+			}
+			break;
+		case S_CSI:
+			switch (byteclass[c]) {
+			case C_CTL:
+				if (c == 0x18 || c == 0x1a) /* CAN, SUB */
+					term.state = S_GROUND;
+				else
+					ctrl(c);
+				break;
+			case C_ESC:
+				term.state = S_ESC;
+				term.inter = 0;
+				break;
+			case C_DIGIT:
+				if (term.narg == 0)
+					term.narg = 1;
+				if (term.narg <= NARG && term.arg[term.narg - 1] < ARG_MAX)
+					term.arg[term.narg - 1] =
+						term.arg[term.narg - 1] * 10 + c - '0';
+				break;
+			case C_SEP:
+				if (term.narg == 0)
+					term.narg = 1;
+				if (c == ':' && term.narg < NARG)
+					term.sub |= 1 << term.narg;
+				if (term.narg <= NARG)
+					term.narg++;
+				break;
+			case C_PRIV:
+				term.priv = c;
+				break;
+			case C_INTER:
+				term.inter = c;
+				break;
+			case C_FINAL:
+				term.state = S_GROUND;
+				if (term.narg > NARG)
+					term.narg = NARG;
+				if (term.inter == 0)
+					csiseq(c);
+				term.inter = 0;
+				break;
+			default:
+				break;
+			}
+			break;
+		case S_OSC:
+		case S_DCS:
+			/* strings are swallowed up to BEL or ST */
+			if (c == '\a')
+				term.state = S_GROUND;
+			else if (c == 0x1b) {
+				term.state = S_ESC;
+				term.inter = 0;
+			}
+			break;
+		}
+	}
+}
+
+/* copy a ring of rows starting at top into a new x by y grid */
+struct tattr *
+ring_resize(struct tattr *map, int top, int x, int y) {
+	struct tattr *rmap;
+	int i, w;
+
+	/* one slot per row */
+	rmap = calloc(x * y, sizeof(*rmap));
+	if (rmap == NULL)
+		err(1, "calloc");
+
+	/* unroll the old ring into the new one */
+	if (map != NULL) {
+		w = x < term.width ? x : term.width;
+		for (i = 0; i < y && i < term.rows; i++)
+			memcpy(rmap + i * x,
+					map + ((top + i) % term.rows) * term.width,
+					w * sizeof(*rmap));
+		free(map);
+	}
+
+	return rmap;
+}
+
+/* resize the grid to x columns and y rows, keeping what fits */
+void
+term_resize(int x, int y) {
+	term.map = ring_resize(term.map, term.top, x, y);
+	term.alt = ring_resize(term.alt, term.alttop, x, y);
+
+	term.width = x;
+	term.height = term.rows = y;
+	term.top = term.alttop = 0;
+
+	/* the margins are reset to the full screen, the cursor kept inside */
+	term.margin0 = 0;
+	term.margin1 = term.height;
+	if (term.cursor.x >= term.width)
+		term.cursor.x = term.width - 1;
+	if (term.cursor.y >= term.height)
+		term.cursor.y = term.height - 1;
+	term.wrapnext = 0;
+
+	free(term.dirty);
+	free(term.damage);
+	term.dirty = calloc((term.height + 8) / 8, 1);
+	term.damage = calloc(term.height + 1, sizeof(*term.damage));
+	if (term.dirty == NULL || term.damage == NULL)
+		err(1, "calloc");
+
+	free(term.hist.line);
+	free(term.selrow);
+	term.hist.line = calloc(term.width, sizeof(*term.hist.line));
+	term.selrow = calloc(term.width, sizeof(*term.selrow));
+	if (term.hist.line == NULL || term.selrow == NULL)
+		err(1, "calloc");
+
+	/* selections may not reach past the last row */
+	if (term.sel.e.y >= term.hist.lines + term.rows)
+		term.sel.on = 0;
+	if (term.clip.e.y >= term.hist.lines + term.rows)
+		term.clip.on = 0;
+
+	/* style 0 is the default everything starts out with */
+	if (term.styles == NULL) {
+		style_grow();
+		pen_update();
+	}
+
+	term.redraw_pos.x = term.redraw_pos.y = 0;
+	term.shift.n = 0;
+	damage_all();
+}
+
+/* free what the core allocated for term, it can be zeroed and reused */
+void
+term_free() {
+	hist_clear();
+	free(term.hist.buf);
+	free(term.hist.line);
+	free(term.selrow);
+	free(term.map);
+	free(term.alt);
+	free(term.dirty);
+	free(term.damage);
+	free(term.styles);
+	free(term.stylehash);
+}
@@ -0,0 +1,271 @@
+#define NARG 16			/* csi parameters kept per sequence */
+#define ARG_MAX 65535		/* csi parameters are clamped to this */
+#define HISTLINES 10000		/* default for xt.scrollback */
+#define HIST_MEM_MAX (64 << 20)	/* scrollback never holds more bytes than this */
+#define HIST_BLOCK_LINES 256	/* lines per scrollback block */
+
+#define HIST_LINE_SIZE 5	/* encoded line: uint16_t cells, runs, flags */
+#define HIST_RUN_SIZE 17	/* encoded run: uint16_t count, style, flags */
+#define HIST_GLYPH_SIZE 3	/* encoded codepoint, 21 bits */
+#define LZ_MIN 3
+#define LZ_HASH_BITS 12
+#define LZ_HASH (1 << LZ_HASH_BITS)
+#define STYLE_MAX 0xffff	/* styles interned before unused ones are dropped */
+#define STYLE_NONE 0xffff	/* empty slot of term.stylehash */
+#define WORD_DELIM " \t\"'`()<>[]{}|;"	/* where a word selection stops */
+
+#define FOREACH_ROW(Y)	for (Y = 0; Y < term.rows; Y++)
+#define FOREACH_CELL(Y, X)	FOREACH_ROW(Y) for (X = 0; X < term.width; X++)
+
+/* cells of row y, term.map is a ring of rows starting at term.top */
+#define ROW(y)	(term.map + ((term.top + (y)) % term.rows) * term.width)
+#define DEBUG(...)	warnx(__VA_ARGS__)
+#define LEN(a)		(sizeof(a) / sizeof((a)[0]))
+
+/* n-th csi parameter, or d when it was omitted or zero */
+#define DEFARG(n, d)	(term.arg[n] ? term.arg[n] : (d))
+
+#define SAME_ATTR(a, b)	((a).style == (b).style && (a).flags == (b).flags)
+#define SAME_STYLE(a, b)	((a).fg == (b).fg && (a).bg == (b).bg \
+		&& (a).ul == (b).ul && (a).attr == (b).attr)
+
+/* style colors: 0 is the default, then the 256 palette entries, then rgb */
+#define COLOR_PAL(n)	((n) + 1)
+#define COLOR_RGB(rgb)	(1 << 24 | (rgb))
+#define IS_RGB(c)	((c) >> 24)
+
+#define DIRTY_SET(y)	(term.dirty[(y) >> 3] |= 1 << ((y) & 7))
+#define DIRTY_ISSET(y)	(term.dirty[(y) >> 3] & 1 << ((y) & 7))
+#define DIRTY_CLR(y)	(term.dirty[(y) >> 3] &= ~(1 << ((y) & 7)))
+
+struct xt_cursor {
+	int x, y;
+};
+
+/* everything sgr() sets, cells refer to interned copies */
+struct style {
+	uint32_t fg, bg;
+	uint32_t ul;	/* underline color, 0 follows fg */
+	uint16_t attr;
+};
+
+/* state kept by DECSC / SCP */
+struct xt_saved {
+	struct xt_cursor cursor;
+	struct style pen;
+};
+
+/* damaged columns of a row, x1 exclusive */
+struct xt_span {
+	int x0, x1;
+};
+
+/*
+ * a selection, in lines counted from the oldest history line with the
+ * screen after it.  b and e are the first and last cell selected, the
+ * anchor and point as they are snapped to words or lines
+ */
+struct xt_sel {
+	struct xt_cursor anchor, point;	/* where the drag started, where it is */
+	struct xt_cursor b, e;
+	int snap;
+	char on;
+};
+
+/* display rows y0 to y1 moved up by n, or down when n is negative */
+struct xt_shift {
+	int y0, y1;
+	int n;
+};
+
+enum {
+	UP    = 'A',
+	DOWN  = 'B',
+	RIGHT = 'C',
+	LEFT  = 'D'
+};
+
+/* style attributes */
+enum {
+	BOLD      = 1 << 0,
+	DIM       = 1 << 1,
+	ITALIC    = 1 << 2,
+	UNDERLINE = 1 << 3,
+	REVERSE   = 1 << 4,
+	BLINK     = 1 << 5,
+	INVISIBLE = 1 << 6,
+	STRUCK    = 1 << 7,
+	OVERLINE  = 1 << 8,
+	UL_STYLE  = 7 << 9	/* how UNDERLINE is drawn, see below */
+};
+
+/* underline styles, the 4:n sub-parameter */
+enum {
+	UL_SINGLE = 1,
+	UL_DOUBLE,
+	UL_CURLY,
+	UL_DOTTED,
+	UL_DASHED
+};
+
+#define UL_SET(attr, n)	((attr) = ((attr) & ~UL_STYLE) | (n) << 9)
+#define UL_GET(attr)	((attr) >> 9 & 7)
+
+/* cell flags */
+enum {
+	WIDE    = 1 << 0,	/* first cell of a double width character */
+	WDUMMY  = 1 << 1,	/* the cell covered by the one before it */
+	WRAPPED = 1 << 2	/* last cell of a row the text went on from */
+};
+
+/* what repeated clicks select */
+enum {
+	SEL_CHAR,
+	SEL_WORD,
+	SEL_LINE
+};
+
+/* parser states */
+enum {
+	S_GROUND,
+	S_ESC,
+	S_CSI,
+	S_OSC,
+	S_DCS
+};
+
+/* byte classes, see byteclass[] */
+enum {
+	C_CTL,
+	C_ESC,
+	C_INTER,
+	C_DIGIT,
+	C_SEP,
+	C_PRIV,
+	C_FINAL,
+	C_DEL,
+	C_UTF
+};
+
+struct tattr {
+	uint32_t ch;	/* codepoint */
+	uint16_t style;	/* index into term.styles */
+	uint8_t flags;
+};
+
+/* encoded scrollback lines, packed once the block is full */
+struct hist_block {
+	struct hist_block *prev, *next;
+	int nlines;
+	size_t len;	/* encoded bytes */
+	size_t plen;	/* packed bytes, 0 while unpacked */
+	size_t size;	/* bytes allocated for data */
+	uint8_t *data;
+};
+
+struct history {
+	struct hist_block *head, *tail;
+	int lines, max;
+	size_t mem;
+	struct hist_block *cached;	/* block currently unpacked into buf */
+	uint8_t *buf;
+	size_t bufsiz;
+	struct tattr *line;		/* scratch row for hist_line() */
+};
+
+typedef struct term_s {
+	int width, height;
+	int fg, bg;
+	int default_fg, default_bg;
+	struct xt_cursor cursor;
+	char wrapnext;	/* the last column was written, wrap before the next */
+	int margin0, margin1;	/* rows that scroll, margin1 exclusive */
+	char origin;	/* DECOM, cursor rows count from margin0 */
+	struct xt_cursor winsiz;
+	struct tattr *map;
+	int rows, top;
+	struct tattr *alt;	/* the inactive grid */
+	int alttop;
+	char altscreen;
+	struct xt_saved saved;
+	struct history hist;
+	int view;	/* lines the viewport is scrolled back */
+	struct xt_sel sel;	/* shown, and owned as PRIMARY */
+	struct xt_sel clip;	/* what was copied to CLIPBOARD */
+	struct tattr *selrow;	/* scratch row for sel_row() */
+	uint8_t *dirty;
+	struct xt_span *damage;
+	struct xt_shift shift;	/* scrolling the back buffer has not seen yet */
+	int shown0, shown1;	/* rows to copy to the window in full */
+	int padding;
+	uint16_t cursor_char;
+	struct xt_cursor redraw_pos;
+	char wants_redraw;
+	int render;
+	char urgent, jump;	/* render now, render rarely */
+	int frame_ms;
+	long long last_frame;
+	int state;
+	int arg[NARG];
+	int narg;
+	uint16_t sub;	/* bit n: arg[n] followed a colon */
+	char priv, inter;
+	char utf[6];
+	int nutf;
+	struct style pen;	/* what sgr() set */
+	uint16_t penid, blankid;	/* the pen, and its background alone */
+	struct style *styles;	/* interned styles */
+	uint16_t *stylehash;	/* open addressing, 2 * stylesiz slots */
+	int nstyles, stylesiz;
+	char *shell;
+	char cursor_vis;
+	char bracketed;	/* mode 2004, pastes are framed */
+	char ttydead;
+	pid_t pid;
+} term_t;
+
+static const uint8_t byteclass[256] = {
+	[0x00 ... 0x1a] = C_CTL,
+	[0x1b]          = C_ESC,
+	[0x1c ... 0x1f] = C_CTL,
+	[0x20 ... 0x2f] = C_INTER,
+	[0x30 ... 0x39] = C_DIGIT,
+	[0x3a ... 0x3b] = C_SEP,
+	[0x3c ... 0x3f] = C_PRIV,
+	[0x40 ... 0x7e] = C_FINAL,
+	[0x7f]          = C_DEL,
+	[0x80 ... 0xff] = C_UTF
+};
+
+/* the terminal being worked on, a frontend may keep several */
+extern term_t *termp;
+#define term	(*termp)
+
+/* protos */
+void damage_view(int, int, int);
+void damage(int, int, int);
+void damage_all();
+void scroll_view(int, int, int);
+struct tattr *view_row(int);
+void view_scroll(int);
+void sel_start(struct xt_sel *, int, int, int);
+void sel_extend(struct xt_sel *, int, int);
+void sel_clear(struct xt_sel *);
+char *sel_text(const struct xt_sel *, size_t *);
+void sel_drop(struct xt_sel *, int);
+struct tattr *sel_row(struct tattr *, int);
+int utf_encode(uint32_t, char *);
+int utf_len(char *);
+uint32_t utf_combine(const char *);
+uint16_t style_id(const struct style *);
+size_t lz_pack(const uint8_t *, size_t, uint8_t *, size_t);
+void lz_unpack(const uint8_t *, size_t, uint8_t *);
+void hist_clear();
+void term_write(const char *, size_t);
+void term_putc(uint32_t);
+void term_resize(int, int);
+void term_free();
+int valid_xy(int, int);
+
+/* supplied by the frontend: move the pixels of term.shift and clear it */
+void shift_flush();